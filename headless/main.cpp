@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "batch.h"
+#include "bus.h"
+#include "cart.h"
+#include "input.h"
+
+// Runs the emulator without a window, as fast as it goes. Meant for machines
+// without a display.
+
+using namespace nes;
+
+void setup_spdlog() {
+  auto logger = spdlog::stderr_color_mt("nes");
+  spdlog::set_default_logger(logger);
+
+  // Nobody is watching, only complain when something goes wrong.
+  spdlog::set_level(spdlog::level::warn);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [options] <rom> <frames> [input file]\n", name);
+  fprintf(stderr, "       %s [options] --batch <manifest> [threads]\n", name);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Options\n");
+  fprintf(stderr, "  --dynarec       run hot code as native code\n");
+  fprintf(stderr, "  --differential  same, and check it against the "
+                  "interpreter\n");
+  fprintf(stderr, "  --skip-idle     skip loops that wait for the next "
+                  "vblank\n");
+}
+
+// Run every job of the manifest, and print one line per job.
+static int run_batch(const char *manifest, size_t threads,
+                     cpu::dynarec::Mode recompiler, bool skip_idle_loops) {
+  auto jobs = batch::load_manifest(manifest);
+  if (!jobs) {
+    return 1;
+  }
+
+  using std::chrono::steady_clock;
+  auto start = steady_clock::now();
+
+  // Tells us how many threads it ended up using.
+  auto results = batch::run(*jobs, threads, recompiler, skip_idle_loops);
+
+  auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        steady_clock::now() - start)
+                        .count();
+
+  uint64_t total_frames = 0;
+  auto failed = 0;
+
+  printf("rom\tinput\tframes\thash\ttime_ms\tfps\tmismatches\n");
+  for (size_t i = 0; i < jobs->size(); i++) {
+    auto &job = (*jobs)[i];
+    auto &result = results[i];
+    auto input = job.input_path.empty() ? "-" : job.input_path.c_str();
+
+    if (!result.ok) {
+      printf("%s\t%s\t%llu\tfailed\t-\t-\t-\n", job.rom_path.c_str(), input,
+             (unsigned long long)job.frames);
+      failed++;
+      continue;
+    }
+
+    auto fps = result.elapsed_us > 0 ? (double)job.frames * 1e6 /
+                                           (double)result.elapsed_us
+                                     : 0.0;
+    printf("%s\t%s\t%llu\t%016llx\t%.3f\t%.1f\t%llu\n",
+           job.rom_path.c_str(), input, (unsigned long long)job.frames,
+           (unsigned long long)result.hash, (double)result.elapsed_us / 1000,
+           fps, (unsigned long long)result.mismatches);
+    total_frames += job.frames;
+
+    // Same as a single ROM, disagreeing with the interpreter is failing.
+    if (result.mismatches > 0)
+      failed++;
+  }
+
+  auto fps = elapsed_us > 0 ? (double)total_frames * 1e6 / (double)elapsed_us
+                            : 0.0;
+  fprintf(stderr,
+          "%zu jobs, %llu frames in %.3f ms (%.1f fps) on %zu threads\n",
+          jobs->size(), (unsigned long long)total_frames,
+          (double)elapsed_us / 1000, fps, threads);
+
+  return failed > 0 ? 1 : 0;
+}
+
+int main(int argc, const char **argv) {
+  setup_spdlog();
+
+  const char *name = argv[0];
+  auto recompiler = cpu::dynarec::Mode::Off;
+  auto skip_idle_loops = false;
+
+  // Options go first, shift them out of the way.
+  for (; argc >= 2; argc--, argv++) {
+    std::string option = argv[1];
+    if (option == "--dynarec")
+      recompiler = cpu::dynarec::Mode::On;
+    else if (option == "--differential")
+      recompiler = cpu::dynarec::Mode::Differential;
+    else if (option == "--skip-idle")
+      skip_idle_loops = true;
+    else
+      break;
+  }
+
+  if (argc >= 2 && std::string(argv[1]) == "--batch") {
+    if (argc < 3 || argc > 4) {
+      usage(name);
+      return 1;
+    }
+
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    try {
+      if (argc == 4)
+        threads = std::stoul(argv[3]);
+    } catch (...) {
+      usage(name);
+      return 1;
+    }
+
+    return run_batch(argv[2], threads, recompiler, skip_idle_loops);
+  }
+
+  if (argc < 3 || argc > 4) {
+    usage(name);
+    return 1;
+  }
+
+  uint64_t frames = 0;
+  try {
+    frames = std::stoull(argv[2]);
+  } catch (...) {
+    usage(name);
+    return 1;
+  }
+
+  auto loaded_cart = cart::load(argv[1]);
+  if (!loaded_cart) {
+    return 1;
+  }
+
+  input::InputScript inputs;
+  if (argc == 4) {
+    auto loaded_inputs = input::load(argv[3]);
+    if (!loaded_inputs) {
+      return 1;
+    }
+
+    inputs = *loaded_inputs;
+  }
+
+  // The bus is too big for the stack.
+  auto bus = std::make_unique<bus::Bus>(*loaded_cart);
+  bus->set_recompiler(recompiler);
+  bus->cpu.skip_idle_loops = skip_idle_loops;
+
+  using std::chrono::steady_clock;
+  auto start = steady_clock::now();
+
+  for (uint64_t frame = 0; frame < frames; frame++) {
+    bus->controller_1.state = inputs.state(frame);
+    // Only the last frame gets hashed, skip drawing the others.
+    bus->run_frame(frame + 1 == frames);
+    bus->ppu.frame_complete = false;
+  }
+
+  auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        steady_clock::now() - start)
+                        .count();
+  auto fps = elapsed_us > 0 ? (double)frames * 1e6 / (double)elapsed_us : 0.0;
+
+  printf("frames: %llu\n", (unsigned long long)frames);
+  printf("time: %.3f ms\n", (double)elapsed_us / 1000);
+  printf("fps: %.1f\n", fps);
+
+  auto &cpu = bus->cpu;
+  auto lookups = cpu.block_hits + cpu.block_misses;
+  printf("blocks: %.2f%% hits, %llu decoded, %llu uncached instructions\n",
+         lookups > 0 ? (double)cpu.block_hits * 100 / (double)lookups : 0.0,
+         (unsigned long long)cpu.block_misses,
+         (unsigned long long)cpu.uncached_instructions);
+  if (cpu.skip_idle_loops)
+    printf("idle: %llu cycles skipped (%.2f%%)\n",
+           (unsigned long long)cpu.skipped_cycles,
+           cpu.clock > 0 ? (double)cpu.skipped_cycles * 100 / (double)cpu.clock
+                         : 0.0);
+  if (bus->recompiler) {
+    auto &recompiler = *bus->recompiler;
+    printf("dynarec: %llu blocks compiled, %llu native runs, %llu "
+           "mismatches\n",
+           (unsigned long long)recompiler.compiled_blocks,
+           (unsigned long long)recompiler.native_runs,
+           (unsigned long long)recompiler.mismatches);
+  }
+  printf("hash: %016llx\n", (unsigned long long)bus->ppu.screen_hash());
+
+  // The interpreter is the reference, a run that disagrees with it failed.
+  if (bus->recompiler && bus->recompiler->mismatches > 0)
+    return 1;
+
+  return 0;
+}
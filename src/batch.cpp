@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "batch.h"
+#include "bus.h"
+#include "cart.h"
+#include "input.h"
+
+namespace nes::batch {
+auto logger = spdlog::stderr_color_mt("nes::batch");
+
+std::optional<std::vector<Job>>
+load_manifest(const std::string &file_path) noexcept {
+  std::ifstream file(file_path);
+  if (!file) {
+    logger->error("Unable to open the manifest {}", file_path);
+    return std::nullopt;
+  }
+
+  std::vector<Job> jobs;
+  std::string line;
+
+  for (size_t line_number = 1; std::getline(file, line); line_number++) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream stream(line);
+    Job job;
+
+    if (!(stream >> job.rom_path >> job.input_path >> job.frames)) {
+      logger->error("Invalid job on line {} of {}", line_number, file_path);
+      return std::nullopt;
+    }
+
+    if (job.input_path == "-")
+      job.input_path.clear();
+
+    jobs.push_back(std::move(job));
+  }
+
+  logger->debug("Loaded {} jobs from {}", jobs.size(), file_path);
+  return jobs;
+}
+
+namespace {
+// A job in flight. The emulator is only built once a thread first gets to it,
+// and torn down as soon as it is done, so queued jobs stay cheap.
+struct Instance {
+  size_t index;
+  std::shared_ptr<const cart::Rom> rom;
+  const input::InputScript *inputs;
+  uint64_t frames;
+  cpu::dynarec::Mode recompiler;
+  bool skip_idle_loops;
+
+  std::unique_ptr<bus::Bus> bus{};
+  uint64_t frame = 0;
+  std::chrono::steady_clock::duration elapsed{};
+};
+
+// Every thread owns a queue. The owner works off the back, thieves take from
+// the front, so they grab whatever the owner is the furthest from touching.
+struct WorkQueue {
+  std::mutex mutex;
+  std::deque<Instance *> instances;
+
+  void push(Instance *instance) noexcept {
+    std::lock_guard lock(mutex);
+    instances.push_back(instance);
+  }
+
+  Instance *pop() noexcept {
+    std::lock_guard lock(mutex);
+    if (instances.empty())
+      return nullptr;
+
+    auto instance = instances.back();
+    instances.pop_back();
+    return instance;
+  }
+
+  Instance *steal() noexcept {
+    std::lock_guard lock(mutex);
+    if (instances.empty())
+      return nullptr;
+
+    auto instance = instances.front();
+    instances.pop_front();
+    return instance;
+  }
+};
+
+// Run a single frame of the instance. Returns whether it has frames left.
+bool run_frame(Instance &instance) noexcept {
+  auto start = std::chrono::steady_clock::now();
+
+  if (!instance.bus) {
+    // Every instance gets its own cart (RAM, mapper state), all of them point
+    // at the same ROM.
+    auto cart = cart::create(instance.rom);
+    instance.bus = std::make_unique<bus::Bus>(*cart);
+    instance.bus->set_recompiler(instance.recompiler);
+    instance.bus->cpu.skip_idle_loops = instance.skip_idle_loops;
+  }
+
+  auto &bus = *instance.bus;
+  bus.controller_1.state = instance.inputs->state(instance.frame);
+  // Only the last frame gets hashed, nobody sees the others.
+  instance.frame++;
+  bus.run_frame(instance.frame == instance.frames);
+  bus.ppu.frame_complete = false;
+
+  instance.elapsed += std::chrono::steady_clock::now() - start;
+  return instance.frame < instance.frames;
+}
+
+void work(std::vector<WorkQueue> &queues, size_t id,
+          std::atomic<size_t> &remaining,
+          std::vector<JobResult> &results) noexcept {
+  auto &own = queues[id];
+
+  while (remaining.load(std::memory_order_acquire) > 0) {
+    auto instance = own.pop();
+
+    for (size_t i = 1; instance == nullptr && i < queues.size(); i++)
+      instance = queues[(id + i) % queues.size()].steal();
+
+    if (instance == nullptr) {
+      // Everything left is being run by someone else.
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (run_frame(*instance)) {
+      own.push(instance);
+      continue;
+    }
+
+    auto &recompiler = instance->bus->recompiler;
+    results[instance->index] = JobResult{
+        .ok = true,
+        .hash = instance->bus->ppu.screen_hash(),
+        .elapsed_us = (uint64_t)std::chrono::duration_cast<
+                          std::chrono::microseconds>(instance->elapsed)
+                          .count(),
+        .mismatches = recompiler ? recompiler->mismatches : 0,
+    };
+
+    instance->bus.reset();
+    remaining.fetch_sub(1, std::memory_order_release);
+  }
+}
+} // namespace
+
+std::vector<JobResult> run(const std::vector<Job> &jobs, size_t &threads,
+                           cpu::dynarec::Mode recompiler,
+                           bool skip_idle_loops) noexcept {
+  std::vector<JobResult> results(jobs.size());
+
+  // Load every ROM and input file once, instances only ever read them.
+  std::map<std::string, std::shared_ptr<const cart::Rom>> roms;
+  std::map<std::string, input::InputScript> inputs;
+  const input::InputScript no_inputs;
+
+  std::vector<Instance> instances;
+  instances.reserve(jobs.size());
+
+  for (size_t i = 0; i < jobs.size(); i++) {
+    auto &job = jobs[i];
+
+    if (!roms.contains(job.rom_path)) {
+      auto rom = cart::load_rom(job.rom_path);
+      if (!rom || !cart::create(*rom)) {
+        logger->error("Skipping {}, the cart didn't load", job.rom_path);
+        continue;
+      }
+
+      roms[job.rom_path] = *rom;
+    }
+
+    const input::InputScript *job_inputs = &no_inputs;
+    if (!job.input_path.empty()) {
+      if (!inputs.contains(job.input_path)) {
+        auto loaded = input::load(job.input_path);
+        if (!loaded) {
+          logger->error("Skipping {}, the input didn't load", job.input_path);
+          continue;
+        }
+
+        inputs[job.input_path] = *loaded;
+      }
+
+      job_inputs = &inputs[job.input_path];
+    }
+
+    if (job.frames == 0) {
+      results[i] = JobResult{.ok = true};
+      continue;
+    }
+
+    instances.push_back(Instance{
+        .index = i,
+        .rom = roms[job.rom_path],
+        .inputs = job_inputs,
+        .frames = job.frames,
+        .recompiler = recompiler,
+        .skip_idle_loops = skip_idle_loops,
+    });
+  }
+
+  threads = std::max<size_t>(1, std::min(threads, instances.size()));
+  logger->info("Running {} jobs on {} threads", instances.size(), threads);
+
+  // Deal the jobs out round robin, stealing evens things out from there.
+  std::vector<WorkQueue> queues(threads);
+  for (size_t i = 0; i < instances.size(); i++)
+    queues[i % threads].instances.push_back(&instances[i]);
+
+  std::atomic<size_t> remaining = instances.size();
+  std::vector<std::thread> workers;
+
+  for (size_t id = 1; id < threads; id++)
+    workers.emplace_back(work, std::ref(queues), id, std::ref(remaining),
+                         std::ref(results));
+
+  // The calling thread pitches in too.
+  work(queues, 0, remaining, results);
+
+  for (auto &worker : workers)
+    worker.join();
+
+  return results;
+}
+} // namespace nes::batch
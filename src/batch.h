@@ -0,0 +1,54 @@
+#ifndef NES_BATCH_H
+#define NES_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dynarec.h"
+
+namespace nes::batch {
+// A ROM, run for a number of frames while fed an input script.
+struct Job {
+  std::string rom_path;
+  // Empty to run without any input.
+  std::string input_path;
+  uint64_t frames = 0;
+};
+
+struct JobResult {
+  // Whether the job ran at all (its ROM and input loaded).
+  bool ok = false;
+  // Hash of the last frame, see `PPU::screen_hash`.
+  uint64_t hash = 0;
+  // Time spent emulating the job, over whichever threads ended up running it.
+  uint64_t elapsed_us = 0;
+  // Native blocks that disagreed with the interpreter, only ever counted in
+  // `Mode::Differential`. Any at all and the job failed.
+  uint64_t mismatches = 0;
+};
+
+// Manifests are plain text, one job per line,
+//
+//   <rom> <input file, or - for none> <frames>
+//
+// Empty lines and lines starting with # are ignored.
+std::optional<std::vector<Job>>
+load_manifest(const std::string &file_path) noexcept;
+
+// Run every job, each on its own emulator instance, spread over `threads`
+// threads. Results come back in the same order as the jobs. There's never more
+// threads than jobs that can run, `threads` is set to how many were used.
+//
+// Jobs are split into frames. Every thread keeps running the same instance a
+// frame at a time, threads that run out of work steal instances from the
+// others, so a handful of long jobs don't leave the rest of the cores idle.
+std::vector<JobResult>
+run(const std::vector<Job> &jobs, size_t &threads,
+    cpu::dynarec::Mode recompiler = cpu::dynarec::Mode::Off,
+    bool skip_idle_loops = false) noexcept;
+} // namespace nes::batch
+
+#endif // NES_BATCH_H
@@ -1,107 +1,432 @@
-#include <functional>
+#include <algorithm>
 
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
 #include "bus.h"
+#include "cpu-impl.h"
+#include "dynarec-impl.h"
 
 namespace nes::bus {
 auto logger = spdlog::stderr_color_mt("nes::bus");
 
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "modernize-avoid-bind"
 Bus::Bus(const std::shared_ptr<cart::Cart> &cart) noexcept
-    : wram(std::array<uint8_t, wram_size>()), cart(cart),
-      cpu(cpu::CPU(std::bind(&Bus::read, this, std::placeholders::_1),
-                   std::bind(&Bus::write, this, std::placeholders::_1,
-                             std::placeholders::_2))),
+    : wram(std::array<uint8_t, wram_size>()), cart(cart), cpu(*this),
       ppu(cart), controller_1() {
   logger->trace("Creating a new bus.");
   logger->trace("Created a wram of size {0:#x} ({0}) bytes.", wram.size());
+
+  for (size_t i = 0; i < pages.size(); i++) {
+    auto address = i * page_size;
+
+    if (address < 0x2000) {
+      // 2kB of wram, mirrored all the way to 0x1fff.
+      auto data = &wram[address & 0x07ff];
+      pages[i] = Page{.data = data, .writable_data = data};
+    } else if (address < 0x4000) {
+      pages[i] = Page{.handler = PageHandler::Ppu};
+    } else if (address < 0x4400) {
+      pages[i] = Page{.handler = PageHandler::Io};
+    }
+  }
+
+  map_cart();
+
+  // The CPU runs 3x slower than the PPU, and the reset already took some
+  // cycles.
+  scheduler.schedule(scheduler::Event::Cpu, cpu.clock * 3);
+  scheduler.schedule(scheduler::Event::Nmi, ppu.dots_until(241, 1));
+}
+
+void Bus::map_cart() noexcept {
+  logger->debug("Mapping cart pages.");
+
+  for (size_t i = 0x4400 / page_size; i < pages.size(); i++) {
+    // The cart only backs the pages it can serve straight from its memory.
+    // Writes to ROM always go to the mapper.
+    pages[i] = Page{
+        .data = cart->prg_page(i * page_size),
+        .writable_data = cart->writable_prg_page(i * page_size),
+        .handler = PageHandler::Cart,
+    };
+  }
+
+  cart_generation = cart->bank_generation();
 }
-#pragma clang diagnostic pop
 
 uint8_t Bus::read(uint16_t address) noexcept {
-  logger->trace("Reading from address {:#06x}", address);
+  auto &page = pages[address >> 10];
+  if (page.data != nullptr)
+    return page.data[address & (page_size - 1)];
 
-  uint8_t value;
-  if (cart->bus_read(address, value)) {
-    return value;
+  return read_slow(address, page.handler);
+}
+
+void Bus::write(uint16_t address, uint8_t value) noexcept {
+  auto &page = pages[address >> 10];
+  if (page.writable_data != nullptr) {
+    page.writable_data[address & (page_size - 1)] = value;
+    return;
   }
 
-  switch (address) {
-  case 0x0000 ... 0x1fff: return wram[address & 0x07ff];
-  case 0x2000 ... 0x3fff: return ppu.bus_read(address & 0x7);
-  case 0x4016 ... 0x4017: {
-    auto val = (captured_controller_1 & 0x80) > 0;
-    captured_controller_1 <<= 1;
-    return val;
+  write_slow(address, value, page.handler);
+}
+
+std::span<const uint8_t> Bus::rom_code(uint16_t address) const noexcept {
+  // PRG RAM is mapped below $8000, and can be written to even when it isn't
+  // mapped writable here.
+  auto &page = pages[address >> 10];
+  if (address < 0x8000 || page.data == nullptr ||
+      page.writable_data != nullptr)
+    return {};
+
+  auto offset = address & (page_size - 1);
+  return {page.data + offset, (size_t)(page_size - offset)};
+}
+
+uint32_t Bus::code_generation() const noexcept { return cart_generation; }
+
+uint8_t *Bus::ram(uint16_t address) noexcept {
+  if (address >= 0x2000)
+    return nullptr;
+
+  return &wram[address & 0x07ff];
+}
+
+uint8_t Bus::stable_bits(uint16_t address) const noexcept {
+  // WRAM, and everything the cart maps from $6000 up, only changes when the
+  // CPU writes to it. None of our mappers do anything on reads.
+  if (address < 0x2000 || address >= 0x6000)
+    return 0xff;
+
+  // The vblank flag only goes up when the vblank starts, which is an event.
+  // Reading the status again only clears it (and the address latch) again.
+  if ((address & 0xe007) == 0x2002)
+    return 0x80;
+
+  return 0;
+}
+
+void Bus::set_recompiler(cpu::dynarec::Mode mode) noexcept {
+  if (mode == cpu::dynarec::Mode::Off) {
+    recompiler.reset();
+    return;
   }
-  default: logger->trace("Ignoring read from {:#06x}", address); return 0;
+
+  if (!recompiler)
+    recompiler =
+        std::make_unique<cpu::dynarec::Recompiler<Bus>>(cpu, *this, mode);
+  recompiler->mode = mode;
+}
+
+uint8_t Bus::read_slow(uint16_t address, PageHandler handler) noexcept {
+  logger->trace("Reading from address {:#06x}", address);
+
+  switch (handler) {
+  case PageHandler::Ppu:
+    catch_up_ppu(current_cycle() + 1);
+    return ppu.bus_read(address & 0x7);
+
+  case PageHandler::Io:
+    if (address == 0x4016 || address == 0x4017) {
+      auto val = (captured_controller_1 & 0x80) > 0;
+      captured_controller_1 <<= 1;
+      return val;
+    }
+
+    if (address < 0x4020)
+      break;
+
+    [[fallthrough]];
+
+  case PageHandler::Cart: {
+    uint8_t value;
+    if (cart->bus_read(address, value))
+      return value;
+  } break;
   }
+
+  logger->trace("Ignoring read from {:#06x}", address);
+  return 0;
 }
 
-void Bus::write(uint16_t address, uint8_t value) noexcept {
+void Bus::write_slow(uint16_t address, uint8_t value,
+                     PageHandler handler) noexcept {
   logger->trace("Writing to address {:#06x} = {:#04x}", address, value);
-  if (cart->bus_write(address, value)) {
+
+  switch (handler) {
+  case PageHandler::Ppu:
+    catch_up_ppu(current_cycle() + 1);
+    ppu.bus_write(address & 0x7, value);
     return;
-  }
 
-  switch (address) {
-  case 0x0000 ... 0x1fff: wram[address & 0x07ff] = value; break;
-  case 0x2000 ... 0x3fff: ppu.bus_write(address & 0x7, value); break;
+  case PageHandler::Io:
+    if (address == 0x4014) {
+      logger->debug("Starting OAM DMA on page {:#04x}.", value);
+
+      oam_page = value;
+      oam_addr = 0x00;
+      oam_dma = true;
+      dma_cycles = 0;
+
+      // The CPU is suspended until the transfer completes, and the transfer
+      // starts on the next CPU cycle.
+      scheduler.cancel(scheduler::Event::Cpu);
+      scheduler.schedule(scheduler::Event::Dma, current_cycle() + 3);
+      cpu.yield();
+      return;
+    }
+
+    if (address == 0x4016 || address == 0x4017) {
+      captured_controller_1 = controller_1.state;
+      return;
+    }
+
+    if (address < 0x4020)
+      break;
 
-  case 0x4014:
-    logger->debug("Starting OAM DMA on page {:#04x}.", value);
+    [[fallthrough]];
 
-    oam_page = value;
-    oam_addr = 0x00;
-    oam_dma = true;
+  case PageHandler::Cart:
+    // Mapper writes can switch banks and mirroring, which the PPU sees.
+    catch_up_ppu(current_cycle() + 1);
 
+    if (cart->bus_write(address, value)) {
+      if (cart->bank_generation() != cart_generation)
+        map_cart();
+
+      // The CPU planned its run without the IRQ poll, cut it short.
+      if (cart->irq_enabled() && !scheduler.scheduled(scheduler::Event::Irq)) {
+        schedule_irq();
+        cpu.yield();
+      }
+
+      return;
+    }
     break;
+  }
+
+  logger->trace("Ignoring write to {:#06x}", address);
+}
 
-  case 0x4016 ... 0x4017: captured_controller_1 = controller_1.state; break;
-  default: logger->trace("Ignoring write to {:#06x}", address); break;
+uint64_t Bus::current_cycle() const noexcept {
+  return cpu_running ? cpu.clock * 3 : elapsed_cycles;
+}
+
+void Bus::catch_up_ppu(uint64_t until) noexcept {
+  if (ppu_clock >= until)
+    return;
+
+  ppu.run(until - ppu_clock);
+  ppu_clock = until;
+}
+
+void Bus::run_cpu(uint64_t until) noexcept {
+  // Run whole instructions back-to-back, as long as they start before the next
+  // event (an instruction on the same cycle as an event still goes first), and
+  // before `until`.
+  auto last_cycle = std::min(
+      scheduler.next_deadline_except(scheduler::Event::Cpu), until - 1);
+  auto budget = std::min<uint64_t>(last_cycle / 3 - cpu.clock + 1, 1 << 20);
+
+  // The budget ends right before the next event, so that's how far the CPU may
+  // skip an idle loop ahead.
+  //
+  // The IRQ line is level triggered, the CPU takes it on the first instruction
+  // boundary it has interrupts enabled. While the line is held, check it
+  // before every instruction.
+  if (cart->irq()) {
+    if (!cpu.status.I) {
+      cpu.irq();
+      scheduler.schedule(scheduler::Event::Cpu, cpu.clock * 3);
+      return;
+    }
+
+    budget = 1;
   }
+
+  cpu_running = true;
+  if (recompiler)
+    recompiler->run((int)budget);
+  else
+    cpu.run((int)budget);
+  cpu_running = false;
+
+  // Writing to OAMDMA suspends the CPU, the DMA will wake it up.
+  if (!oam_dma)
+    scheduler.schedule(scheduler::Event::Cpu, cpu.clock * 3);
 }
 
-void Bus::tick() noexcept {
-  ppu.tick();
+void Bus::run_dma() noexcept {
+  catch_up_ppu(elapsed_cycles + 1);
+  dma_cycles++;
 
-  // The CPU runs 3x slower than the PPU.
-  if (elapsed_cycles % 3 == 0) {
-    if (!oam_dma) {
-      cpu.tick();
+  // Waiting for DMA to sync. 513 / 514.
+  if (dma_wait) {
+    if (elapsed_cycles % 2 == 1) {
+      dma_wait = false;
+    }
+  } else {
+    if (elapsed_cycles % 2 == 0) {
+      dma_data = read(((uint16_t)oam_page << 8) | ((uint16_t)oam_addr));
     } else {
-      // Waiting for DMA to sync. 513 / 514.
-      if (dma_wait) {
-        if (elapsed_cycles % 2 == 1) {
-          dma_wait = false;
-        }
-      } else {
-        if (elapsed_cycles % 2 == 0) {
-          dma_data = read(((uint16_t)oam_page << 8) | ((uint16_t)oam_addr));
-        } else {
-          ppu.oam_memory[oam_addr] = dma_data;
-          oam_addr++;
-
-          if (oam_addr == 0) {
-            dma_data = 0x00;
-            dma_wait = true;
-            oam_dma = false;
-          }
-        }
+      ppu.oam_memory[oam_addr] = dma_data;
+      oam_addr++;
+
+      if (oam_addr == 0) {
+        dma_data = 0x00;
+        dma_wait = true;
+        oam_dma = false;
       }
     }
   }
 
+  if (oam_dma) {
+    scheduler.schedule(scheduler::Event::Dma, elapsed_cycles + 3);
+    return;
+  }
+
+  // Hand the bus back to the CPU, minus the cycles we stole.
+  cpu.clock += dma_cycles;
+  scheduler.cancel(scheduler::Event::Dma);
+  scheduler.schedule(scheduler::Event::Cpu, cpu.clock * 3);
+}
+
+void Bus::run_nmi() noexcept {
+  catch_up_ppu(elapsed_cycles + 1);
+
   if (ppu.nmi) {
     ppu.nmi = false;
     cpu.nmi();
+
+    // The interrupt took some CPU time. If the CPU is suspended by a DMA, it
+    // will pick the new clock up once the DMA is done.
+    if (scheduler.scheduled(scheduler::Event::Cpu))
+      scheduler.schedule(scheduler::Event::Cpu, cpu.clock * 3);
+  }
+
+  scheduler.schedule(scheduler::Event::Nmi,
+                     elapsed_cycles + ppu::PPU::dots_per_frame);
+}
+
+void Bus::run_irq() noexcept {
+  // Clocking the PPU is what clocks the mapper's scanline counter. If the line
+  // goes up, the CPU picks it up before its next instruction.
+  catch_up_ppu(elapsed_cycles + 1);
+  scheduler.cancel(scheduler::Event::Irq);
+
+  if (cart->irq_enabled())
+    schedule_irq();
+}
+
+void Bus::schedule_irq() noexcept {
+  // MMC3 sees A12 rise once per scanline, either on the first sprite fetch
+  // (sprites in $1000) or on the first background fetch for the next scanline
+  // (background in $1000). Poll right after both.
+  auto dots = std::min(ppu.dots_until_cycle(261), ppu.dots_until_cycle(325));
+  scheduler.schedule(scheduler::Event::Irq, ppu_clock + dots);
+}
+
+void Bus::run_until(uint64_t master_cycle) noexcept {
+  while (true) {
+    auto event = scheduler.next();
+    auto deadline = scheduler.deadline(event);
+
+    if (deadline >= master_cycle)
+      break;
+
+    elapsed_cycles = deadline;
+
+    switch (event) {
+    case scheduler::Event::Cpu: run_cpu(master_cycle); break;
+    case scheduler::Event::Dma: run_dma(); break;
+    case scheduler::Event::Nmi: run_nmi(); break;
+    case scheduler::Event::Irq: run_irq(); break;
+    case scheduler::Event::Count: break;
+    }
+  }
+
+  catch_up_ppu(master_cycle);
+  elapsed_cycles = master_cycle;
+}
+
+void Bus::run_frame(bool render) noexcept {
+  ppu.write_screen = render;
+
+  // The frame completes on the last dot of scanline 260.
+  run_until(ppu_clock + ppu.dots_until(260, 340) + 1);
+}
+
+void Bus::tick() noexcept { run_until(elapsed_cycles + 1); }
+
+void Bus::save(Savestate &state) const noexcept {
+  state.magic = Savestate::magic_value;
+  state.version = Savestate::current_version;
+  state.size = sizeof(Savestate);
+
+  state.wram = wram;
+
+  state.oam_dma = oam_dma;
+  state.dma_wait = dma_wait;
+  state.oam_page = oam_page;
+  state.oam_addr = oam_addr;
+  state.dma_data = dma_data;
+  state.dma_cycles = dma_cycles;
+
+  scheduler.save(state.scheduler);
+  state.ppu_clock = ppu_clock;
+  state.elapsed_cycles = elapsed_cycles;
+
+  state.controller_1 = controller_1.state;
+  state.captured_controller_1 = captured_controller_1;
+
+  cpu.save(state.cpu);
+  ppu.save(state.ppu);
+  cart->save(state.cart);
+}
+
+bool Bus::load(const Savestate &state) noexcept {
+  if (state.magic != Savestate::magic_value ||
+      state.version != Savestate::current_version ||
+      state.size != sizeof(Savestate)) {
+    logger->error("Savestate version {} doesn't match ours ({})",
+                  state.version, Savestate::current_version);
+    return false;
+  }
+
+  if (!cart->load(state.cart)) {
+    logger->error("Savestate is from another cart, or its banks are corrupt");
+    return false;
   }
 
-  elapsed_cycles++;
+  wram = state.wram;
+
+  oam_dma = state.oam_dma;
+  dma_wait = state.dma_wait;
+  oam_page = state.oam_page;
+  oam_addr = state.oam_addr;
+  dma_data = state.dma_data;
+  dma_cycles = state.dma_cycles;
+
+  scheduler.load(state.scheduler);
+  ppu_clock = state.ppu_clock;
+  elapsed_cycles = state.elapsed_cycles;
+
+  controller_1.state = state.controller_1;
+  captured_controller_1 = state.captured_controller_1;
+
+  cpu.load(state.cpu);
+  ppu.load(state.ppu);
+
+  // The mapper may have switched banks under the page table.
+  map_cart();
+  return true;
 }
 
 Bus::~Bus() noexcept { logger->trace("Destructed the bus."); }
 } // namespace nes::bus
+
+// Instantiate the CPU (and its recompiler) right next to the bus, so bus
+// accesses can be inlined.
+template class nes::cpu::CPU<nes::bus::Bus>;
+template class nes::cpu::dynarec::Recompiler<nes::bus::Bus>;
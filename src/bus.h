@@ -4,31 +4,128 @@
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <span>
+#include <type_traits>
 
 #include "cart.h"
 #include "controller.h"
 #include "cpu.h"
+#include "dynarec.h"
 #include "ppu.h"
+#include "scheduler.h"
 
 namespace nes::bus {
 using namespace nes;
 
+// Who handles accesses to a page that isn't backed by host memory.
+enum class PageHandler : uint8_t {
+  Cart, // The cart (and its mapper).
+  Ppu,  // PPU registers, $2000 -> $3fff.
+  Io,   // APU and I/O registers, $4000 -> $401f. Rest of the page is cart.
+};
+
+// A 1kB page of the CPU address space. Reads from pages backed by host memory
+// are a single indexed load, and so are writes to pages backed by RAM.
+// Everything else takes the slow path through the page's handler.
+struct Page {
+  const uint8_t *data = nullptr;
+  uint8_t *writable_data = nullptr;
+  PageHandler handler = PageHandler::Cart;
+};
+
+const static auto wram_size = 1 << 11;
+
+// A snapshot of the whole machine. It is flat and trivially copyable, so
+// snapshots can live in preallocated buffers and get memcpy'd around, or
+// written out as is. Everything is in host byte order.
+struct Savestate {
+  constexpr const static uint32_t magic_value = 0x5353454e; // "NESS"
+  // Bump whenever the layout of any part of the state changes.
+  constexpr const static uint32_t current_version = 2;
+
+  uint32_t magic;
+  uint32_t version;
+  // Catches layout changes that forgot the version bump, or another compiler.
+  uint32_t size;
+
+  std::array<uint8_t, wram_size> wram;
+
+  bool oam_dma;
+  bool dma_wait;
+  uint8_t oam_page;
+  uint8_t oam_addr;
+  uint8_t dma_data;
+  uint64_t dma_cycles;
+
+  scheduler::SchedulerState scheduler;
+  uint64_t ppu_clock;
+  uint64_t elapsed_cycles;
+
+  uint8_t controller_1;
+  uint8_t captured_controller_1;
+
+  cpu::CPUState cpu;
+  ppu::PPUState ppu;
+  cart::CartState cart;
+};
+static_assert(std::is_trivially_copyable_v<Savestate>);
+
 class Bus {
-  const static auto wram_size = 1 << 11;
   // Allocate 2kB (2048 bytes) of wram (working RAM, as nintendo calls it).
   std::array<uint8_t, wram_size> wram;
 
+  const static auto page_size = 1 << 10;
+  // Until the page table is built, everything goes through the cart (that is
+  // where the CPU finds the reset vector).
+  std::array<Page, (1 << 16) / page_size> pages{};
+  // Bank generation of the cart when we last mapped its pages.
+  uint32_t cart_generation = 0;
+
+  // (Re)build the page table entries for the cart.
+  void map_cart() noexcept;
+
+  uint8_t read_slow(uint16_t address, PageHandler handler) noexcept;
+  void write_slow(uint16_t address, uint8_t value,
+                  PageHandler handler) noexcept;
+
   bool oam_dma = false;
   bool dma_wait = true; // Wait for DMA to start.
   uint8_t oam_page = 0x00;
   uint8_t oam_addr = 0x00;
   uint8_t dma_data = 0x00;
+  // CPU cycles stolen by the ongoing DMA.
+  uint64_t dma_cycles = 0;
+
+  scheduler::Scheduler scheduler;
+  // Number of master cycles the PPU has been clocked for.
+  uint64_t ppu_clock = 0;
+
+  // Whether the CPU is in the middle of a run. The CPU runs ahead of the last
+  // dispatched event, so its clock is the current time.
+  bool cpu_running = false;
+
+  // Current master cycle, as seen by whoever is accessing the bus.
+  [[nodiscard]] uint64_t current_cycle() const noexcept;
+  // Clock the PPU until it has seen every master cycle before `until`. The PPU
+  // lags behind, and is only caught up when someone can observe it.
+  void catch_up_ppu(uint64_t until) noexcept;
+
+  // Event handlers.
+  void run_cpu(uint64_t until) noexcept;
+  void run_dma() noexcept;
+  void run_nmi() noexcept;
+  void run_irq() noexcept;
+
+  // Poll the cart's IRQ line for as long as the mapper may raise it.
+  void schedule_irq() noexcept;
 
 public:
   std::shared_ptr<cart::Cart> cart;
   controller::StandardController controller_1;
-  cpu::CPU cpu;
+  cpu::CPU<Bus> cpu;
   ppu::PPU ppu;
+  // Only there when it's turned on, see `set_recompiler`.
+  std::unique_ptr<cpu::dynarec::Recompiler<Bus>> recompiler;
 
   // System metrics.
   uint64_t elapsed_cycles = 0;
@@ -54,7 +151,39 @@ public:
   void write(uint16_t address, uint8_t value) noexcept;
   uint8_t read(uint16_t address) noexcept;
 
+  // The ROM behind `address`, up to the end of its page. Empty if it isn't
+  // ROM, the CPU only caches code that can't change under it.
+  [[nodiscard]] std::span<const uint8_t>
+  rom_code(uint16_t address) const noexcept;
+  // Changes whenever the cart pages get remapped.
+  [[nodiscard]] uint32_t code_generation() const noexcept;
+  // The WRAM behind `address`, or nullptr if it isn't WRAM. It never moves,
+  // and has no side effects, so recompiled code reads and writes it directly.
+  [[nodiscard]] uint8_t *ram(uint16_t address) noexcept;
+  // The bits of a read from `address` that stay the same until the next event,
+  // for the CPU's idle loop detection.
+  [[nodiscard]] uint8_t stable_bits(uint16_t address) const noexcept;
+
+  // Run the CPU on the recompiler (or stop, with `Mode::Off`).
+  void set_recompiler(cpu::dynarec::Mode mode) noexcept;
+
+  // Run the system until (but excluding) the given master cycle. The master
+  // clock runs at the PPU dot rate.
+  void run_until(uint64_t master_cycle) noexcept;
+  // Run the system until the PPU completes the current frame. Frames that
+  // aren't rendered leave `screen` alone, and skip most of the pixel work.
+  // Everything the game can see (sprite 0 hits, vblank) stays the same.
+  void run_frame(bool render = true) noexcept;
+  // Run the system for a single master cycle.
   void tick() noexcept;
+
+  using Snapshot = Savestate;
+
+  // Snapshot the machine in between `run_until` calls.
+  void save(Savestate &state) const noexcept;
+  // Restore a snapshot. Fails, leaving the machine alone, if the snapshot is
+  // from another version or another cart.
+  bool load(const Savestate &state) noexcept;
 };
 } // namespace nes::bus
 
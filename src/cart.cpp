@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 
 #include <spdlog/sinks/stdout_color_sinks.h>
@@ -5,64 +6,193 @@
 
 #include "cart.h"
 #include "mappers/mmc0.h"
+#include "mappers/mmc1.h"
+#include "mappers/mmc3.h"
 
 namespace nes::cart {
 auto logger = spdlog::stderr_color_mt("nes::cart");
 
-Cart::Cart(std::vector<uint8_t> prg_rom, uint8_t prg_banks,
-           std::vector<uint8_t> chr_rom, uint8_t chr_banks,
-           std::unique_ptr<mappers::Mapper> mapper,
-           MirroringMode mirroring_mode) noexcept
-    : prg_rom(std::move(prg_rom)), prg_banks(prg_banks),
-      chr_rom(std::move(chr_rom)), chr_banks(chr_banks),
-      mapper(std::move(mapper)), mirroring_mode(mirroring_mode) {
-  logger->debug("PRG Size: {}", this->prg_rom.size());
-  logger->debug("CHR Size: {}", this->chr_rom.size());
-  logger->info("Mirroring mode: {}", mirroring_mode == MirroringMode::Horizontal
-                                         ? "Horizontal"
-                                         : "Vertical");
+static void decode_tile(const uint8_t *data, DecodedTile &tile) noexcept {
+  for (size_t row = 0; row < 8; row++) {
+    uint8_t lo = data[row];
+    uint8_t hi = data[row + 8];
+
+    uint16_t decoded = 0;
+    uint16_t flipped = 0;
+
+    for (auto col = 0; col < 8; col++) {
+      uint16_t pixel =
+          (((hi >> (7 - col)) & 0x1) << 1) | ((lo >> (7 - col)) & 0x1);
+
+      decoded |= pixel << (14 - col * 2);
+      flipped |= pixel << (col * 2);
+    }
+
+    tile.rows[row] = decoded;
+    tile.flipped_rows[row] = flipped;
+  }
 }
 
-bool Cart::bus_read(uint16_t address, uint8_t &value) noexcept {
-  uint16_t mapped_addr = 0;
-  if (mapper->should_bus_read(address, mapped_addr)) {
-    value = prg_rom[mapped_addr];
-    return true;
+Cart::Cart(std::shared_ptr<const Rom> rom,
+           std::unique_ptr<mappers::Mapper> mapper) noexcept
+    : rom(std::move(rom)), prg_ram(prg_ram_size), mapper(std::move(mapper)) {
+  auto chr_is_ram = this->rom->chr_rom.empty();
+  if (chr_is_ram) {
+    chr_ram.resize(chr_ram_size);
+    ram_tiles.resize(chr_ram.size() / 16);
+    dirty_tiles.resize(ram_tiles.size(), 1);
   }
 
-  return false;
+  logger->debug("PRG Size: {}", this->rom->prg_rom.size());
+  logger->debug("CHR Size: {}, RAM: {}", chr().size(), chr_is_ram);
+
+  this->mapper->mirroring = this->rom->mirroring;
+  this->mapper->attach(this->rom->prg_rom, prg_ram, chr(), chr_is_ram);
+}
+
+bool Cart::bus_read(uint16_t address, uint8_t &value) const noexcept {
+  auto data = prg_page(address);
+  if (data == nullptr)
+    return false;
+
+  value = data[address & 0x03ff];
+  return true;
 }
 
 bool Cart::bus_write(uint16_t address, uint8_t value) noexcept {
-  uint16_t mapped_addr = 0;
-  if (mapper->should_bus_write(address, mapped_addr)) {
-    prg_rom[mapped_addr] = value;
+  if (address >= 0x8000) {
+    mapper->write(address, value);
+    return true;
+  }
+
+  auto data = writable_prg_page(address);
+  if (data != nullptr) {
+    data[address & 0x03ff] = value;
     return true;
   }
 
   return false;
 }
 
-bool Cart::ppu_read(uint16_t address, uint8_t &value) noexcept {
-  uint16_t mapped_addr = 0;
-  if (mapper->should_ppu_read(address, mapped_addr)) {
-    value = chr_rom[mapped_addr];
-    return true;
+uint8_t Cart::ppu_read(uint16_t address) const noexcept {
+  return mapper->chr_windows[address >> 10][address & 0x03ff];
+}
+
+void Cart::ppu_write(uint16_t address, uint8_t value) noexcept {
+  if (!mapper->chr_writable)
+    return;
+
+  auto offset = chr_offset(address);
+  chr_ram[offset] = value;
+  dirty_tiles[offset >> 4] = 1;
+  chr_writes++;
+}
+
+std::span<const uint8_t> Cart::chr() const noexcept {
+  if (chr_ram.empty())
+    return rom->chr_rom;
+
+  return chr_ram;
+}
+
+size_t Cart::chr_offset(uint16_t address) const noexcept {
+  return mapper->chr_windows[address >> 10] - chr().data() +
+         (address & 0x03ff);
+}
+
+const DecodedTile &Cart::tile(uint16_t address) noexcept {
+  auto index = chr_offset(address & ~0x000f) >> 4;
+  if (chr_ram.empty())
+    return rom->chr_tiles[index];
+
+  auto &tile = ram_tiles[index];
+  if (dirty_tiles[index]) {
+    decode_tile(&chr_ram[index * 16], tile);
+    dirty_tiles[index] = 0;
   }
 
-  return false;
+  return tile;
 }
 
-bool Cart::ppu_write(uint16_t address, uint8_t value) noexcept {
-  uint16_t mapped_addr = 0;
-  if (mapper->should_ppu_write(address, mapped_addr)) {
-    chr_rom[mapped_addr] = value;
-    return true;
+const uint8_t *Cart::prg_page(uint16_t address) const noexcept {
+  if (address < 0x6000)
+    return nullptr;
+
+  auto window = (address - 0x6000) >> 13;
+  auto data = mapper->prg_windows[window];
+  if (data == nullptr)
+    return nullptr;
+
+  return data + (address & 0x1c00);
+}
+
+uint8_t *Cart::writable_prg_page(uint16_t address) noexcept {
+  if (address < 0x6000 || !mapper->prg_writable[(address - 0x6000) >> 13])
+    return nullptr;
+
+  // Only PRG RAM is ever writable, which is ours (the mapper just points at
+  // it).
+  return prg_ram.data() + (prg_page(address) - prg_ram.data());
+}
+
+void Cart::save(CartState &state) const noexcept {
+  state.mapper_id = rom->mapper_id;
+  state.prg_rom_size = rom->prg_rom.size();
+  state.chr_rom_size = rom->chr_rom.size();
+  state.rom_hash = rom->hash;
+
+  std::copy(prg_ram.begin(), prg_ram.end(), state.prg_ram.begin());
+  if (chr_ram.empty())
+    state.chr_ram.fill(0);
+  else
+    std::copy(chr_ram.begin(), chr_ram.end(), state.chr_ram.begin());
+
+  mapper->save(state.mapper);
+}
+
+bool Cart::load(const CartState &state) noexcept {
+  if (state.mapper_id != rom->mapper_id ||
+      state.prg_rom_size != rom->prg_rom.size() ||
+      state.chr_rom_size != rom->chr_rom.size() ||
+      state.rom_hash != rom->hash)
+    return false;
+
+  // The mapper checks its windows before taking anything, so nothing has been
+  // touched yet if it fails.
+  if (!mapper->load(state.mapper))
+    return false;
+
+  std::copy(state.prg_ram.begin(), state.prg_ram.end(), prg_ram.begin());
+
+  if (!chr_ram.empty()) {
+    std::copy(state.chr_ram.begin(), state.chr_ram.end(), chr_ram.begin());
+    std::fill(dirty_tiles.begin(), dirty_tiles.end(), 1);
   }
 
-  return false;
+  return true;
 }
 
+MirroringMode Cart::mirroring_mode() const noexcept {
+  return mapper->mirroring;
+}
+
+uint32_t Cart::bank_generation() const noexcept {
+  return mapper->bank_generation;
+}
+
+uint32_t Cart::chr_generation() const noexcept {
+  // Loading a state bumps the bank generation too.
+  return mapper->bank_generation + chr_writes;
+}
+
+bool Cart::watches_a12() const noexcept { return mapper->watches_a12; }
+
+void Cart::a12_rise() noexcept { mapper->a12_rise(); }
+
+bool Cart::irq() const noexcept { return mapper->irq; }
+
+bool Cart::irq_enabled() const noexcept { return mapper->irq_enabled; }
+
 Cart::~Cart() noexcept { logger->trace("Destructed the cart."); }
 
 struct Header {
@@ -98,13 +228,17 @@ select_mapper(uint8_t id, uint8_t num_prg_chunks,
   switch (id) { // NOLINT(*-multiway-paths-covered)
   case 0:
     return std::make_unique<mappers::MMC0>(num_prg_chunks, num_chr_chunks);
+  case 1:
+    return std::make_unique<mappers::MMC1>(num_prg_chunks, num_chr_chunks);
+  case 4:
+    return std::make_unique<mappers::MMC3>(num_prg_chunks, num_chr_chunks);
 
   default: return std::nullopt;
   }
 }
 
-std::optional<std::shared_ptr<Cart>>
-load(const std::string &file_path) noexcept {
+std::optional<std::shared_ptr<const Rom>>
+load_rom(const std::string &file_path) noexcept {
   std::ifstream file(file_path, std::ios::binary);
   if (!file) {
     logger->error("Unable to open the cart from {}", file_path);
@@ -129,31 +263,62 @@ load(const std::string &file_path) noexcept {
     file.seekg(512, std::ios_base::cur);
   }
 
-  uint8_t mapper_id =
+  auto rom = std::make_shared<Rom>();
+  rom->mapper_id =
       header.flags_1.mapper_lower | (header.flags_2.mapper_upper << 4);
-  logger->info("Cart {} uses mapper_id {:03d}", file_path, mapper_id);
+  logger->info("Cart {} uses mapper_id {:03d}", file_path, rom->mapper_id);
 
-  // We are only handling file type 1 for now.
-  std::vector<uint8_t> prg_rom((1 << 14) * header.num_prg_chunks);
-  file.read((char *)prg_rom.data(), (long)prg_rom.size());
+  // We are only handling file type 1 for now. Banks are 16kB of PRG and 8kB
+  // of CHR, so the header caps us at 4MB of PRG and 2MB of CHR.
+  rom->prg_banks = header.num_prg_chunks;
+  rom->prg_rom.resize((1 << 14) * (size_t)header.num_prg_chunks);
+  file.read((char *)rom->prg_rom.data(), (long)rom->prg_rom.size());
 
-  std::vector<uint8_t> chr_rom((1 << 13) * header.num_chr_chunks);
-  file.read((char *)chr_rom.data(), (long)chr_rom.size());
+  rom->chr_banks = header.num_chr_chunks;
+  rom->chr_rom.resize((1 << 13) * (size_t)header.num_chr_chunks);
+  file.read((char *)rom->chr_rom.data(), (long)rom->chr_rom.size());
 
   file.close();
 
-  auto mapper =
-      select_mapper(mapper_id, header.num_prg_chunks, header.num_chr_chunks);
+  rom->chr_tiles.resize(rom->chr_rom.size() / 16);
+  for (size_t i = 0; i < rom->chr_tiles.size(); i++)
+    decode_tile(&rom->chr_rom[i * 16], rom->chr_tiles[i]);
+
+  rom->hash = 0xcbf29ce484222325;
+  for (auto memory : {std::span<const uint8_t>(rom->prg_rom),
+                      std::span<const uint8_t>(rom->chr_rom)})
+    for (auto byte : memory) {
+      rom->hash ^= byte;
+      rom->hash *= 0x100000001b3;
+    }
+
+  rom->mirroring = header.flags_1.mirroring == 0 ? MirroringMode::Horizontal
+                                                 : MirroringMode::Vertical;
+  logger->info("Mirroring mode: {}", rom->mirroring == MirroringMode::Horizontal
+                                         ? "Horizontal"
+                                         : "Vertical");
+
+  return rom;
+}
+
+std::optional<std::shared_ptr<Cart>>
+create(const std::shared_ptr<const Rom> &rom) noexcept {
+  auto mapper = select_mapper(rom->mapper_id, rom->prg_banks, rom->chr_banks);
   if (!mapper) {
+    logger->error("Unsupported mapper_id {:03d}", rom->mapper_id);
     return std::nullopt;
   }
 
-  auto mirroring_mode = header.flags_1.mirroring == 0
-                            ? MirroringMode::Horizontal
-                            : MirroringMode::Vertical;
+  return std::make_shared<Cart>(rom, std::move(*mapper));
+}
+
+std::optional<std::shared_ptr<Cart>>
+load(const std::string &file_path) noexcept {
+  auto rom = load_rom(file_path);
+  if (!rom) {
+    return std::nullopt;
+  }
 
-  return std::make_shared<Cart>(prg_rom, header.num_prg_chunks, chr_rom,
-                                header.num_chr_chunks, std::move(*mapper),
-                                mirroring_mode);
+  return create(*rom);
 }
 } // namespace nes::cart
@@ -1,46 +1,129 @@
 #ifndef NES_CART_H
 #define NES_CART_H
 
+#include <array>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
 #include "mappers/mapper.h"
 
 namespace nes::cart {
-enum class MirroringMode {
-  Horizontal,
-  Vertical,
-  OneScreenLo,
-  OneScreenHi,
+// A pattern table tile, decoded to 2 bits per pixel. The leftmost pixel of a
+// row sits in its top 2 bits.
+struct DecodedTile {
+  std::array<uint16_t, 8> rows;
+  // Mirrored horizontally, for sprites.
+  std::array<uint16_t, 8> flipped_rows;
 };
 
-class Cart {
+// A ROM image, as loaded from disk. Nothing writes to it once it is loaded, so
+// every cart running the same game can share a single copy.
+struct Rom {
   std::vector<uint8_t> prg_rom;
-  const uint8_t prg_banks;
-
+  uint8_t prg_banks = 0;
+  // Empty if the cart comes with CHR RAM instead.
   std::vector<uint8_t> chr_rom;
-  const uint8_t chr_banks;
+  uint8_t chr_banks = 0;
+  // Every tile of the CHR ROM, decoded up front.
+  std::vector<DecodedTile> chr_tiles;
+
+  uint8_t mapper_id = 0;
+  MirroringMode mirroring = MirroringMode::Horizontal;
+
+  // FNV-1a hash of the PRG and CHR ROM, to tell games apart.
+  uint64_t hash = 0;
+};
+
+const static auto prg_ram_size = 1 << 13;
+const static auto chr_ram_size = 1 << 13;
+
+// Snapshot of a cart's RAM and mapper. The ROM isn't part of it, the state
+// only loads back into a cart running the same ROM.
+struct CartState {
+  // Which ROM the state belongs to. Plenty of games share a mapper and ROM
+  // sizes, the hash tells them apart.
+  uint8_t mapper_id;
+  uint32_t prg_rom_size;
+  uint32_t chr_rom_size;
+  uint64_t rom_hash;
+
+  std::array<uint8_t, prg_ram_size> prg_ram;
+  // Unused by carts with CHR ROM.
+  std::array<uint8_t, chr_ram_size> chr_ram;
+  mappers::MapperState mapper;
+};
+
+class Cart {
+
+  std::shared_ptr<const Rom> rom;
+
+  // Mappers that have PRG RAM map it to $6000 -> $7fff.
+  std::vector<uint8_t> prg_ram;
+  // Carts without CHR ROM get 8kB of CHR RAM instead.
+  std::vector<uint8_t> chr_ram;
 
   std::unique_ptr<mappers::Mapper> mapper;
 
+  // CHR RAM tiles are decoded on demand, and indexed by where they live in CHR
+  // memory. Switching banks just points the windows at other tiles, only CHR
+  // RAM writes invalidate anything.
+  std::vector<DecodedTile> ram_tiles;
+  std::vector<uint8_t> dirty_tiles;
+  // Number of CHR RAM writes, so debug views know when to redraw.
+  uint32_t chr_writes = 0;
+
+  // Whichever of CHR ROM or CHR RAM the cart has.
+  [[nodiscard]] std::span<const uint8_t> chr() const noexcept;
+  // Offset of the pattern table address in CHR memory.
+  [[nodiscard]] size_t chr_offset(uint16_t address) const noexcept;
+
 public:
-  Cart(std::vector<uint8_t> prg_rom, uint8_t prg_banks,
-       std::vector<uint8_t> chr_rom, uint8_t chr_banks,
-       std::unique_ptr<mappers::Mapper> mapper,
-       MirroringMode mirroring_mode) noexcept;
+  Cart(std::shared_ptr<const Rom> rom,
+       std::unique_ptr<mappers::Mapper> mapper) noexcept;
   ~Cart() noexcept;
 
-  MirroringMode mirroring_mode;
+  // The mapper may switch mirroring at any time.
+  [[nodiscard]] MirroringMode mirroring_mode() const noexcept;
 
-  bool bus_read(uint16_t address, uint8_t &value) noexcept;
+  bool bus_read(uint16_t address, uint8_t &value) const noexcept;
   bool bus_write(uint16_t address, uint8_t value) noexcept;
-  bool ppu_read(uint16_t address, uint8_t &value) noexcept;
-  bool ppu_write(uint16_t address, uint8_t value) noexcept;
+  // The cart always serves the pattern tables, $0000 -> $1fff.
+  [[nodiscard]] uint8_t ppu_read(uint16_t address) const noexcept;
+  void ppu_write(uint16_t address, uint8_t value) noexcept;
+  // Decoded tile at the given pattern table address.
+  [[nodiscard]] const DecodedTile &tile(uint16_t address) noexcept;
+
+  // Host memory backing the 1kB CPU page at `address`, or null if the page
+  // isn't plain PRG memory.
+  [[nodiscard]] const uint8_t *prg_page(uint16_t address) const noexcept;
+  // Same, but only if the CPU can write straight to that memory (PRG RAM).
+  [[nodiscard]] uint8_t *writable_prg_page(uint16_t address) noexcept;
+  [[nodiscard]] uint32_t bank_generation() const noexcept;
+  // Changes whenever the pattern tables might look different, after a CHR RAM
+  // write or a bank switch.
+  [[nodiscard]] uint32_t chr_generation() const noexcept;
+
+  void save(CartState &state) const noexcept;
+  // Fails, leaving the cart alone, if the state is from another ROM.
+  bool load(const CartState &state) noexcept;
+
+  // Scanline counter and IRQ line of mappers that have them.
+  [[nodiscard]] bool watches_a12() const noexcept;
+  void a12_rise() noexcept;
+  [[nodiscard]] bool irq() const noexcept;
+  [[nodiscard]] bool irq_enabled() const noexcept;
 };
 
+// Load a ROM image, to hand out to as many carts as needed.
+std::optional<std::shared_ptr<const Rom>>
+load_rom(const std::string &file_path) noexcept;
+// Build a fresh cart (powered on, with its own RAM and mapper) around a ROM.
+std::optional<std::shared_ptr<Cart>>
+create(const std::shared_ptr<const Rom> &rom) noexcept;
 std::optional<std::shared_ptr<Cart>>
 load(const std::string &file_path) noexcept;
 } // namespace nes::cart
@@ -0,0 +1,932 @@
+#ifndef NES_CPU_IMPL_H
+#define NES_CPU_IMPL_H
+
+// Definitions of the CPU members. The CPU is templated on its bus, so every
+// translation unit that plugs a bus into it includes this, and instantiates the
+// CPU for it.
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "config.h"
+#include "cpu.h"
+#include "utils.h"
+
+#define SANITY_PANIC(msg)                                                      \
+  do {                                                                         \
+    dump_state();                                                              \
+    PANIC(msg);                                                                \
+  } while (false);
+
+#define read16(addr)                                                           \
+  (((uint16_t)read(addr)) | ((uint16_t)(read(addr + 1)) << 8))
+
+namespace nes::cpu {
+extern std::shared_ptr<spdlog::logger> logger;
+
+template <typename BusT>
+CPU<BusT>::CPU(BusT &bus) noexcept : Registers(), bus(bus) {
+  // Checked here rather than on the class, as the system bus is still an
+  // incomplete type when it declares its CPU.
+  static_assert(Memory<BusT>, "The CPU needs a bus it can read and write.");
+
+  if constexpr (CodeMemory<BusT>)
+    blocks.resize(block_cache_size);
+
+  logger->trace("Constructing the CPU.");
+  logger->trace("M6502 forever!");
+  rst();
+}
+
+template <typename BusT> void CPU<BusT>::rst() noexcept {
+  logger->trace("Resetting the CPU.");
+
+  a = 0;
+  x = 0;
+  y = 0;
+  sp = 0xfd;
+  pc = 0;
+  p = 0;
+  status._ = 1;
+  unpack_flags();
+
+  const uint16_t reset_vec_location = 0xFFFC;
+  pc = read16(reset_vec_location);
+
+  //  dump_state();
+  sanity();
+
+  // Well reset took 8 cycles on actual hardware.
+  pending_cycles = 8;
+  clock += 8;
+}
+
+template <typename BusT> void CPU<BusT>::dump_reg() noexcept {
+  logger->debug("Register dump");
+  logger->debug("  a  = {:#04x}", a);
+  logger->debug("  x  = {:#04x}", x);
+  logger->debug("  y  = {:#04x}", y);
+  logger->debug("  sp = {:#04x}", sp);
+  logger->debug("  pc = {:#06x}", pc);
+  logger->debug("  p  = {:#010b} (0bNV1BDIZC)", p);
+  logger->debug("    p.C = {:b}", static_cast<uint8_t>(status.C));
+  logger->debug("    p.Z = {:b}", static_cast<uint8_t>(status.Z));
+  logger->debug("    p.I = {:b}", static_cast<uint8_t>(status.I));
+  logger->debug("    p.D = {:b}", static_cast<uint8_t>(status.D));
+  logger->debug("    p.B = {:b}", static_cast<uint8_t>(status.B));
+  logger->debug("    p.1 = {:b}", static_cast<uint8_t>(status._));
+  logger->debug("    p.V = {:b}", static_cast<uint8_t>(status.V));
+  logger->debug("    p.N = {:b}", static_cast<uint8_t>(status.N));
+}
+
+template <typename BusT> void CPU<BusT>::sanity() noexcept {
+#ifdef NES_CPU_RT_SANITY
+  if ((p & 0b00100000) != 0b00100000) {
+    SANITY_PANIC("Sanity: always-set status bit is not set.");
+  }
+
+  if (status._ != 1) {
+    SANITY_PANIC("Sanity: always-set status bit is not set, invalid status "
+                 "bitfield pack.");
+  }
+#endif
+}
+
+template <typename BusT> void CPU<BusT>::dump_state() noexcept {
+  logger->debug("Pending cycles: {}", pending_cycles);
+  dump_reg();
+}
+
+template <typename BusT>
+template <op::AddressingMode mode, bool page_penalty, bool cached>
+void CPU<BusT>::addressing_mode() noexcept {
+  if constexpr (mode == op::AddressingMode::Implicit) {
+    logger->trace("Addressing mode: Implicit");
+    // We use the accumulator.
+    fetched = a;
+  } else if constexpr (mode == op::AddressingMode::Immediate) {
+    logger->trace("Addressing mode: Immediate");
+    // Set the jump address to PC.
+    addr_abs = pc;
+    // Increment the program counter;
+    pc++;
+  } else if constexpr (mode == op::AddressingMode::ZeroPage) {
+    logger->trace("Addressing mode: ZeroPage");
+    // Set the jump address to the value read from PC, and wrap it to 256.
+    addr_abs = operand8<cached>() & 0xff;
+    // Increment the program counter;
+    pc++;
+  } else if constexpr (mode == op::AddressingMode::Absolute) {
+    logger->trace("Addressing mode: Absolute");
+    // Yeah, little endian.
+    addr_abs = operand16<cached>();
+    // We read 2 bytes.
+    pc += 2;
+  } else if constexpr (mode == op::AddressingMode::Relative) {
+    logger->trace("Addressing mode: Relative");
+    addr_rel = operand8<cached>();
+    // In case we have a negative offset, set the first 8 bits.
+    if (addr_rel & 0x80)
+      addr_rel |= 0xff00;
+
+    // No need to set the value here as relative is only used for jumps.
+    // Increment the PC again.
+    pc++;
+  } else if constexpr (mode == op::AddressingMode::Indirect) {
+    logger->trace("Addressing mode: Indirect");
+    // Read the 16-bit pointer.
+    uint16_t ptr = operand16<cached>();
+    pc += 2;
+
+    // Now read the actual address to jump to.
+
+    // Hardware bug: we read the wrong address if we are on the page boundary.
+    if ((ptr & 0xff) == 0xff)
+      addr_abs = ((uint16_t)read(ptr)) | (((uint16_t)read(ptr & 0xff00)) << 8);
+    else
+      addr_abs = read16(ptr);
+  } else if constexpr (mode == op::AddressingMode::ZeroPageX) {
+    logger->trace("Addressing mode: ZeroPageX");
+    // Zero page + x, wrapped to 256.
+    addr_abs = ((uint16_t)operand8<cached>() + x) & 0xff;
+    // Increment the PC as usual.
+    pc++;
+  } else if constexpr (mode == op::AddressingMode::ZeroPageY) {
+    logger->trace("Addressing mode: ZeroPageY");
+    // Zero page + y, wrapped to 256.
+    addr_abs = ((uint16_t)operand8<cached>() + y) & 0xff;
+    // Increment the PC as usual.
+    pc++;
+  } else if constexpr (mode == op::AddressingMode::AbsoluteX) {
+    logger->trace("Addressing mode: AbsoluteX");
+    // Usual drill.
+    uint16_t abs = operand16<cached>();
+    pc += 2;
+
+    // ABS + X.
+    addr_abs = abs + x;
+
+    // Check if we crossed the page boundary.
+    if (((addr_abs & 0xff00) != (abs & 0xff00)) && page_penalty)
+      pending_cycles++;
+  } else if constexpr (mode == op::AddressingMode::AbsoluteY) {
+    logger->trace("Addressing mode: AbsoluteY");
+    // Usual drill.
+    uint16_t abs = operand16<cached>();
+    pc += 2;
+
+    // ABS + Y.
+    addr_abs = abs + y;
+
+    // Check if we crossed the page boundary.
+    if (((addr_abs & 0xff00) != (abs & 0xff00)) && page_penalty)
+      pending_cycles++;
+  } else if constexpr (mode == op::AddressingMode::IndirectX) {
+    logger->trace("Addressing mode: IndirectX");
+    // Read the immediate value.
+    uint16_t addr = operand8<cached>();
+    pc++;
+
+    // We won't use read16 as we need to wrap the addresses.
+    uint16_t lo = read((addr + (uint16_t)x) & 0xff);
+    uint16_t hi = read((addr + (uint16_t)x + 1) & 0xff);
+
+    addr_abs = (hi << 8) | lo;
+  } else if constexpr (mode == op::AddressingMode::IndirectY) {
+    logger->trace("Addressing mode: IndirectY");
+    // Read the immediate value.
+    uint16_t addr = operand8<cached>();
+    pc++;
+
+    // We won't use read16 as we need to wrap the addresses.
+    uint16_t lo = read((addr)&0xff);
+    uint16_t hi = read((addr + 1) & 0xff);
+
+    addr_abs = ((hi << 8) | lo) + y;
+
+    // Check if we crossed the page boundary.
+    if ((addr_abs >> 8 != hi) && page_penalty)
+      pending_cycles++;
+  }
+}
+
+template <typename BusT> void CPU<BusT>::flag_nz(uint16_t result) noexcept {
+  nz = result & 0xff;
+}
+
+template <typename BusT> void CPU<BusT>::flag_carry(uint16_t result) noexcept {
+  status.C = result > 0xff;
+}
+
+template <typename BusT> bool CPU<BusT>::negative() const noexcept {
+  return (nz & 0x180) != 0;
+}
+
+template <typename BusT> bool CPU<BusT>::zero() const noexcept {
+  return (nz & 0xff) == 0;
+}
+
+template <typename BusT> void CPU<BusT>::pack_flags() noexcept {
+  status.N = negative();
+  status.Z = zero();
+}
+
+template <typename BusT> void CPU<BusT>::unpack_flags() noexcept {
+  nz = (status.Z ? 0 : 1) | (status.N ? 0x100 : 0);
+}
+
+template <typename BusT>
+template <op::AddressingMode mode>
+void CPU<BusT>::fetch() noexcept {
+  if constexpr (mode != op::AddressingMode::Implicit)
+    fetched = read(addr_abs);
+}
+
+template <typename BusT>
+template <op::Op operation, op::AddressingMode mode>
+void CPU<BusT>::execute() noexcept {
+  if constexpr (operation == op::Op::ADC) {
+    fetch<mode>();
+
+    // A + fetched + carry.
+    uint16_t result = (uint16_t)a + (uint16_t)fetched + (uint16_t)status.C;
+
+    // Set the flags.
+    status.V = ((~((uint16_t)a ^ (uint16_t)fetched) &
+                 ((uint16_t)a ^ (uint16_t)result)) &
+                0x80) > 0;
+    flag_nz(result);
+    flag_carry(result);
+
+    // Put the result in the accumulator.
+    a = result & 0xff;
+
+    // TODO(AG): Check if we need an extra cycle here.
+  } else if constexpr (operation == op::Op::SBC) {
+    fetch<mode>();
+
+    // Bless binary. Inverting the digits makes this same as ADC.
+    uint16_t value = fetched ^ 0xff;
+
+    // A + fetched + carry.
+    uint16_t result = (uint16_t)a + (uint16_t)value + (uint16_t)status.C;
+
+    // Set the flags.
+    status.V = ((result ^ (uint16_t)a) & (result ^ value) & 0x0080) > 0;
+    flag_nz(result);
+    flag_carry(result);
+
+    // Put the result in the accumulator.
+    a = result & 0xff;
+
+    // TODO(AG): Check if we need an extra cycle here.
+  } else if constexpr (operation == op::Op::AND) {
+    fetch<mode>();
+    a &= fetched;
+
+    flag_nz(a);
+
+    // TODO(AG): Check if we need an extra cycle here.
+  } else if constexpr (operation == op::Op::ASL) {
+    fetch<mode>();
+    uint16_t result = ((uint16_t)fetched) << 1;
+
+    flag_carry(result);
+    flag_nz(result);
+
+    if constexpr (mode == op::AddressingMode::Implicit)
+      a = result & 0xff;
+    else
+      write(addr_abs, result & 0xff);
+  } else if constexpr (operation == op::Op::BCC) {
+    if (status.C == 0)
+      branch();
+  } else if constexpr (operation == op::Op::BCS) {
+    if (status.C != 0)
+      branch();
+  } else if constexpr (operation == op::Op::BEQ) {
+    if (zero())
+      branch();
+  } else if constexpr (operation == op::Op::BIT) {
+    fetch<mode>();
+    uint16_t result = ((uint16_t)a) & ((uint16_t)fetched);
+
+    // N comes from the operand, not the result.
+    nz = result | ((fetched & 0x80) << 1);
+    status.V = (fetched >> 6) & 0x1;
+  } else if constexpr (operation == op::Op::BMI) {
+    if (negative())
+      branch();
+  } else if constexpr (operation == op::Op::BNE) {
+    if (!zero())
+      branch();
+  } else if constexpr (operation == op::Op::BPL) {
+    if (!negative())
+      branch();
+  } else if constexpr (operation == op::Op::BRK) {
+    pc++;
+    interrupt(0xfffe);
+  } else if constexpr (operation == op::Op::BVC) {
+    if (status.V == 0)
+      branch();
+  } else if constexpr (operation == op::Op::BVS) {
+    if (status.V != 0)
+      branch();
+  } else if constexpr (operation == op::Op::CLC) {
+    status.C = 0;
+  } else if constexpr (operation == op::Op::CLD) {
+    status.D = 0;
+  } else if constexpr (operation == op::Op::CLI) {
+    status.I = 0;
+  } else if constexpr (operation == op::Op::CLV) {
+    status.V = 0;
+  } else if constexpr (operation == op::Op::CMP) {
+    fetch<mode>();
+
+    uint16_t result = (uint16_t)a - (uint16_t)fetched;
+
+    status.C = a >= fetched;
+    flag_nz(result);
+  } else if constexpr (operation == op::Op::CPX) {
+    fetch<mode>();
+
+    uint16_t result = (uint16_t)x - (uint16_t)fetched;
+
+    status.C = x >= fetched;
+    flag_nz(result);
+  } else if constexpr (operation == op::Op::CPY) {
+    fetch<mode>();
+
+    uint16_t result = (uint16_t)y - (uint16_t)fetched;
+
+    status.C = y >= fetched;
+    flag_nz(result);
+  } else if constexpr (operation == op::Op::DEC) {
+    fetch<mode>();
+
+    uint16_t result = fetched - 1;
+    write(addr_abs, result & 0xff);
+
+    flag_nz(result);
+  } else if constexpr (operation == op::Op::DEX) {
+    x--;
+    flag_nz(x);
+  } else if constexpr (operation == op::Op::DEY) {
+    y--;
+    flag_nz(y);
+  } else if constexpr (operation == op::Op::EOR) {
+    fetch<mode>();
+    a ^= fetched;
+
+    flag_nz(a);
+
+    // TODO(AG): Check for cycle penalty here.
+  } else if constexpr (operation == op::Op::INC) {
+    fetch<mode>();
+
+    uint16_t result = fetched + 1;
+    write(addr_abs, result & 0xff);
+
+    flag_nz(result);
+  } else if constexpr (operation == op::Op::INX) {
+    x++;
+    flag_nz(x);
+  } else if constexpr (operation == op::Op::INY) {
+    y++;
+    flag_nz(y);
+  } else if constexpr (operation == op::Op::JMP) {
+    pc = addr_abs;
+  } else if constexpr (operation == op::Op::JSR) {
+    // We push the current PC due to how 6502 works.
+    pc--;
+    push_pc();
+    pc = addr_abs;
+  } else if constexpr (operation == op::Op::LDA) {
+    fetch<mode>();
+    a = fetched;
+    flag_nz(a);
+  } else if constexpr (operation == op::Op::LDX) {
+    fetch<mode>();
+    x = fetched;
+    flag_nz(x);
+  } else if constexpr (operation == op::Op::LDY) {
+    fetch<mode>();
+    y = fetched;
+    flag_nz(y);
+  } else if constexpr (operation == op::Op::NOP) {
+    // TODO(AG): Add aliased NOPs (unknown instructions).
+  } else if constexpr (operation == op::Op::ORA) {
+    fetch<mode>();
+    a |= fetched;
+    flag_nz(a);
+  } else if constexpr (operation == op::Op::PHA) {
+    push(a);
+  } else if constexpr (operation == op::Op::PHP) {
+    pack_flags();
+    // Pushed with B and the unused bit set.
+    push(p | 0x30);
+  } else if constexpr (operation == op::Op::PLA) {
+    a = pop();
+    flag_nz(a);
+  } else if constexpr (operation == op::Op::PLP) {
+    p = pop();
+    status._ = 1;
+    unpack_flags();
+  } else if constexpr (operation == op::Op::ROL) {
+    fetch<mode>();
+    uint16_t result = (((uint16_t)fetched) << 1) | status.C;
+
+    flag_nz(result);
+    flag_carry(result);
+
+    if constexpr (mode == op::AddressingMode::Implicit)
+      a = result & 0xff;
+    else
+      write(addr_abs, result & 0xff);
+  } else if constexpr (operation == op::Op::ROR) {
+    fetch<mode>();
+    uint16_t result = (((uint16_t)fetched) >> 1) | (((uint16_t)status.C) << 7);
+
+    flag_nz(result);
+    status.C = fetched & 0x01;
+
+    if constexpr (mode == op::AddressingMode::Implicit)
+      a = result & 0xff;
+    else
+      write(addr_abs, result & 0xff);
+  } else if constexpr (operation == op::Op::RTI) {
+    p = pop();
+    status._ = 1;
+    status.B = 1;
+    unpack_flags();
+    pop_pc();
+  } else if constexpr (operation == op::Op::RTS) {
+    pop_pc();
+    pc++;
+  } else if constexpr (operation == op::Op::SEC) {
+    status.C = 1;
+  } else if constexpr (operation == op::Op::SED) {
+    status.D = 1;
+  } else if constexpr (operation == op::Op::SEI) {
+    status.I = 1;
+  } else if constexpr (operation == op::Op::STA) {
+    write(addr_abs, a);
+  } else if constexpr (operation == op::Op::STX) {
+    write(addr_abs, x);
+  } else if constexpr (operation == op::Op::STY) {
+    write(addr_abs, y);
+  } else if constexpr (operation == op::Op::TAX) {
+    x = a;
+    flag_nz(x);
+  } else if constexpr (operation == op::Op::TAY) {
+    y = a;
+    flag_nz(y);
+  } else if constexpr (operation == op::Op::TSX) {
+    x = sp;
+    flag_nz(x);
+  } else if constexpr (operation == op::Op::TXA) {
+    a = x;
+    flag_nz(a);
+  } else if constexpr (operation == op::Op::TXS) {
+    sp = x;
+  } else if constexpr (operation == op::Op::TYA) {
+    a = y;
+    flag_nz(a);
+  } else if constexpr (operation == op::Op::LSR) {
+    fetch<mode>();
+    status.C = fetched & 1;
+
+    uint16_t result = fetched >> 1;
+    flag_nz(result);
+
+    if constexpr (mode == op::AddressingMode::Implicit)
+      a = result & 0xff;
+    else
+      write(addr_abs, result & 0xff);
+  }
+}
+
+template <typename BusT> void CPU<BusT>::branch() noexcept { // Branch!
+  pending_cycles++;
+
+  // Branches are relative.
+  addr_abs = pc + addr_rel;
+
+  // Check if we have a page cross penalty.
+  if ((addr_abs & 0xff00) != (pc & 0xff00))
+    pending_cycles++;
+
+  pc = addr_abs;
+}
+
+template <typename BusT> void CPU<BusT>::interrupt(uint16_t vector) noexcept {
+  logger->trace("Performing CPU interrupt with the vector {:#06x}", vector);
+
+  push_pc();
+
+  // NOTE(AG): Decimal mode shenanigans on the NES 6502.
+  //           Should change this while porting this CPU to other platforms.
+  pack_flags();
+  status.B = 1;
+  push(p);
+  status.B = 0;
+
+  status.I = 1;
+
+  pc = read16(vector);
+  dump_reg();
+}
+
+template <typename BusT> void CPU<BusT>::push(uint8_t value) noexcept {
+  logger->trace("Pushing {:#04x} on stack pos {:#04x}", value, sp);
+
+  write(0x0100 + sp, value);
+  sp--;
+}
+
+template <typename BusT> void CPU<BusT>::push_pc() noexcept {
+  push((pc >> 8) & 0xff);
+  push(pc & 0xff);
+}
+
+template <typename BusT> uint8_t CPU<BusT>::pop() noexcept {
+  sp++;
+  uint8_t value = read(0x0100 + sp);
+
+  logger->trace("Popped {:#04x} from stack pos {:#04x}", value, sp);
+  return value;
+}
+
+template <typename BusT> void CPU<BusT>::pop_pc() noexcept {
+  auto lo = pop();
+  auto hi = pop();
+
+  pc = ((uint16_t)lo) | (((uint16_t)hi) << 8);
+}
+
+template <typename BusT>
+template <bool cached>
+uint8_t CPU<BusT>::operand8() noexcept {
+  if constexpr (cached)
+    return operand & 0xff;
+  else
+    return read(pc);
+}
+
+template <typename BusT>
+template <bool cached>
+uint16_t CPU<BusT>::operand16() noexcept {
+  if constexpr (cached)
+    return operand;
+  else
+    return read16(pc);
+}
+
+template <typename BusT>
+template <uint8_t opcode, bool cached>
+void CPU<BusT>::instruction() noexcept {
+  constexpr auto decoded = op::opcodes[opcode];
+
+  if constexpr (decoded.unknown) {
+    PANIC("Unknown opcode.");
+  } else {
+    // Set the pending cycles.
+    pending_cycles = decoded.cycles;
+    // Calculate stuff using the addressing mode.
+    addressing_mode<decoded.mode, decoded.page_penalty, cached>();
+    // Perform the actual instruction.
+    execute<decoded.operation, decoded.mode>();
+  }
+}
+
+template <typename BusT>
+template <bool cached, size_t... opcodes>
+constexpr std::array<typename CPU<BusT>::Handler, 256>
+CPU<BusT>::make_handlers(std::index_sequence<opcodes...>) noexcept {
+  return {&CPU::instruction<opcodes, cached>...};
+}
+
+template <typename BusT>
+constinit const std::array<typename CPU<BusT>::Handler, 256>
+    CPU<BusT>::handlers =
+        make_handlers<false>(std::make_index_sequence<256>());
+
+template <typename BusT>
+constinit const std::array<typename CPU<BusT>::Handler, 256>
+    CPU<BusT>::cached_handlers =
+        make_handlers<true>(std::make_index_sequence<256>());
+
+template <typename BusT> int CPU<BusT>::step() noexcept {
+  unpack_flags();
+  auto cycles = next_instruction();
+  pack_flags();
+
+  return cycles;
+}
+
+template <typename BusT> int CPU<BusT>::next_instruction() noexcept {
+  // Perform a sanity check.
+  sanity();
+
+  // Read the opcode and increment the PC by 1.
+  opcode = read(pc);
+  pc++;
+
+  logger->trace("Executing opcode {}", op::opcodes[opcode]);
+
+  // Sets the pending cycles, addressing, the instruction itself, all in one.
+  (this->*handlers[opcode])();
+
+  status._ = 1;
+
+  // Perform a sanity check.
+  sanity();
+
+  // Penalties are already accounted for in the pending cycles.
+  clock += pending_cycles;
+  return pending_cycles;
+}
+
+template <typename BusT>
+void CPU<BusT>::compile_block(Block &block,
+                              std::span<const uint8_t> code) noexcept
+  requires CodeMemory<BusT>
+{
+  block.code = code.data();
+  block.size = 0;
+
+  size_t offset = 0;
+  while (block.size < max_block_size && offset < code.size()) {
+    auto opcode = code[offset];
+    auto &decoded = op::opcodes[opcode];
+    size_t length = op::length(decoded.mode);
+
+    // Unknown opcodes panic in `step`, and operands on the next page might
+    // come from another bank.
+    if (decoded.unknown || offset + length > code.size())
+      break;
+
+    uint16_t operand = 0;
+    if (length > 1)
+      operand = code[offset + 1];
+    if (length > 2)
+      operand |= (uint16_t)code[offset + 2] << 8;
+
+    block.instructions[block.size++] = CachedInstruction{
+        .handler = cached_handlers[opcode],
+        .operand = operand,
+        .opcode = opcode,
+    };
+
+    offset += length;
+    if (op::changes_flow(decoded.operation))
+      break;
+  }
+
+  if constexpr (IdleMemory<BusT>)
+    block.idle = block.size > 0 && idle_block(block, offset);
+}
+
+template <typename BusT>
+bool CPU<BusT>::idle_block(const Block &block, size_t length) noexcept
+  requires IdleMemory<BusT>
+{
+  using op::AddressingMode;
+  using op::Op;
+
+  for (uint8_t i = 0; i + 1 < block.size; i++) {
+    auto &instruction = block.instructions[i];
+    auto &decoded = op::opcodes[instruction.opcode];
+
+    switch (decoded.operation) {
+    // Writes, and the stack.
+    case Op::STA:
+    case Op::STX:
+    case Op::STY:
+    case Op::PHA:
+    case Op::PHP:
+    case Op::PLA:
+    case Op::PLP: return false;
+    // Read-modify-writes, unless they're on the accumulator.
+    case Op::ASL:
+    case Op::LSR:
+    case Op::ROL:
+    case Op::ROR:
+    case Op::INC:
+    case Op::DEC:
+      if (decoded.mode != AddressingMode::Implicit)
+        return false;
+      break;
+    default: break;
+    }
+
+    uint16_t address;
+    if (decoded.mode == AddressingMode::ZeroPage)
+      address = instruction.operand & 0xff;
+    else if (decoded.mode == AddressingMode::Absolute)
+      address = instruction.operand;
+    else if (decoded.mode == AddressingMode::Implicit ||
+             decoded.mode == AddressingMode::Immediate)
+      continue;
+    else
+      // Indexed, so we can't tell where it reads from here.
+      return false;
+
+    auto stable = bus.stable_bits(address);
+    if (stable == 0xff)
+      continue;
+
+    // Partly stable, like the vblank flag. Fine if it's loaded, and the loop
+    // only ever looks at N, which is bit 7.
+    auto &next = block.instructions[i + 1];
+    auto next_operation = op::opcodes[next.opcode].operation;
+    if ((stable & 0x80) == 0 || i + 2 != block.size ||
+        (decoded.operation != Op::LDA && decoded.operation != Op::BIT) ||
+        (next_operation != Op::BPL && next_operation != Op::BMI))
+      return false;
+  }
+
+  auto &last = block.instructions[block.size - 1];
+  auto &decoded = op::opcodes[last.opcode];
+
+  // Jumps are checked against PC when the block runs.
+  if (decoded.operation == Op::JMP)
+    return decoded.mode == AddressingMode::Absolute;
+
+  // A branch back to the start.
+  return decoded.mode == AddressingMode::Relative &&
+         (int8_t)last.operand == -(int)length;
+}
+
+template <typename BusT>
+bool CPU<BusT>::run_block() noexcept
+  requires CodeMemory<BusT>
+{
+  auto code = bus.rom_code(pc);
+  if (code.empty())
+    return false;
+
+  auto key = (uintptr_t)code.data();
+  auto &block = blocks[(key ^ (key >> 10)) & (block_cache_size - 1)];
+
+  if (block.code != code.data()) {
+    compile_block(block, code);
+    block_misses++;
+  } else {
+    block_hits++;
+  }
+
+  // Nothing to run, the first instruction straddles two pages.
+  if (block.size == 0)
+    return false;
+
+  auto generation = bus.code_generation();
+
+  // Maybe an idle loop, remember how the iteration started.
+  Registers start{};
+  uint16_t start_nz = 0;
+  uint64_t start_clock = 0;
+  auto idle = false;
+
+  if constexpr (IdleMemory<BusT>) {
+    auto &last = block.instructions[block.size - 1];
+    idle = skip_idle_loops && block.idle &&
+           (op::opcodes[last.opcode].operation != op::Op::JMP ||
+            last.operand == pc);
+
+    if (idle) {
+      start = *this;
+      start_nz = nz;
+      start_clock = clock;
+    }
+  }
+
+  for (uint8_t i = 0; i < block.size; i++) {
+    auto &instruction = block.instructions[i];
+
+    opcode = instruction.opcode;
+    operand = instruction.operand;
+    pc++;
+
+    (this->*instruction.handler)();
+    status._ = 1;
+
+    clock += pending_cycles;
+    budget -= pending_cycles;
+
+    // Out of time, or a mapper write just swapped the rest of the block out
+    // from under us.
+    if (budget <= 0 || bus.code_generation() != generation)
+      break;
+  }
+
+  if (idle)
+    skip_idle(start, start_nz, start_clock);
+
+  return true;
+}
+
+template <typename BusT>
+void CPU<BusT>::skip_idle(const Registers &start, uint16_t start_nz,
+                          uint64_t start_clock) noexcept {
+  // Nothing in the loop writes, and everything it reads stays the same until
+  // the next event, which is where the budget ends. If the registers came back
+  // the same too, every iteration until then does exactly this again.
+  if (pc != start.pc || a != start.a || x != start.x || y != start.y ||
+      sp != start.sp || p != start.p || nz != start_nz)
+    return;
+
+  // Leave the last iteration (or the part of it that fits) to actually run, so
+  // the run ends on the same instruction, and reads what it would have.
+  auto cycles = (int)(clock - start_clock);
+  auto iterations = (budget - 1) / cycles;
+  if (iterations <= 0)
+    return;
+
+  auto skipped = iterations * cycles;
+  clock += skipped;
+  budget -= skipped;
+  skipped_cycles += skipped;
+}
+
+template <typename BusT> int CPU<BusT>::run(int cycle_budget) noexcept {
+  budget = cycle_budget;
+  unpack_flags();
+
+  if constexpr (CodeMemory<BusT>) {
+    while (budget > 0) {
+      if (!run_block()) {
+        budget -= next_instruction();
+        uncached_instructions++;
+      }
+    }
+  } else {
+    while (budget > 0)
+      budget -= next_instruction();
+  }
+
+  pack_flags();
+  return -budget;
+}
+
+template <typename BusT> void CPU<BusT>::yield() noexcept { budget = 0; }
+
+template <typename BusT> void CPU<BusT>::tick() noexcept {
+  logger->trace("Tick.");
+
+  if (pending_cycles > 0) {
+    pending_cycles--;
+    return;
+  }
+
+  step();
+
+  // Well this was also a cycle.
+  pending_cycles--;
+}
+
+template <typename BusT> void CPU<BusT>::irq() noexcept {
+  logger->debug("External IRQ received.");
+  if (status.I) {
+    logger->debug("Ignoring external IRQ (p.i is set)");
+    return;
+  }
+
+  unpack_flags();
+  interrupt(0xFFFE);
+  pending_cycles += 7;
+  clock += 7;
+}
+
+template <typename BusT> void CPU<BusT>::nmi() noexcept {
+  logger->debug("External NMI received.");
+  unpack_flags();
+  interrupt(0xFFFA);
+  pending_cycles += 8;
+  clock += 8;
+}
+
+template <typename BusT>
+void CPU<BusT>::save(CPUState &state) const noexcept {
+  state.registers = *this;
+  state.pending_cycles = pending_cycles;
+  state.clock = clock;
+  state.opcode = opcode;
+}
+
+template <typename BusT>
+void CPU<BusT>::load(const CPUState &state) noexcept {
+  Registers::operator=(state.registers);
+  unpack_flags();
+  pending_cycles = state.pending_cycles;
+  clock = state.clock;
+  opcode = state.opcode;
+}
+
+template <typename BusT>
+CPU<BusT>::~CPU() noexcept { logger->trace("Destructed the CPU."); }
+} // namespace nes::cpu
+
+#undef read16
+#undef SANITY_PANIC
+
+#endif // NES_CPU_IMPL_H
@@ -1,13 +1,22 @@
 #ifndef NES_CPU_H
 #define NES_CPU_H
 
+#include <array>
+#include <concepts>
 #include <cstdint>
 #include <functional>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "opcode.h"
 
 namespace nes::cpu {
+namespace dynarec {
+template <typename BusT> class Recompiler;
+}
+
 // 7  bit  0
 // ---- ----
 // NV1B DIZC
@@ -44,37 +53,159 @@ struct Registers {
   }; // Status register
 };
 
+// Snapshot of the CPU, in between instructions.
+struct CPUState {
+  Registers registers;
+  int32_t pending_cycles;
+  uint64_t clock;
+  uint8_t opcode;
+};
+
+// Anything the CPU can be plugged into. The CPU is templated on its bus, so
+// every memory access is a direct (and usually inlined) call.
+template <typename T>
+concept Memory = requires(T &memory, uint16_t address, uint8_t value) {
+  { memory.read(address) } -> std::same_as<uint8_t>;
+  { memory.write(address, value) } -> std::same_as<void>;
+};
+
+// Memory that can also point the CPU at the ROM behind an address, up to the
+// end of its page (or at nothing, if it isn't ROM). ROM never changes, so the
+// CPU caches decoded code out of it. The generation changes whenever the ROM
+// behind the addresses may have moved.
+template <typename T>
+concept CodeMemory = Memory<T> && requires(T &memory, uint16_t address) {
+  { memory.rom_code(address) } -> std::same_as<std::span<const uint8_t>>;
+  { memory.code_generation() } -> std::same_as<uint32_t>;
+};
+
+// Code memory that also knows which bits of a read can't change before the
+// next event on the master clock, and can be read again without anything
+// adding up. Loops that only wait on those bits can be skipped, see
+// `CPU::skip_idle_loops`.
+template <typename T>
+concept IdleMemory = CodeMemory<T> && requires(T &memory, uint16_t address) {
+  { memory.stable_bits(address) } -> std::same_as<uint8_t>;
+};
+
 using ReadFunction = std::function<uint8_t(uint16_t)>;
 using WriteFunction = std::function<void(uint16_t, uint8_t)>;
 
-class CPU : public Registers {
+// Type-erased memory, for tools that want to plug arbitrary callbacks into the
+// CPU. Every access costs an indirect call, so the system bus doesn't use this.
+class FunctionMemory {
+  ReadFunction read_function;
+  WriteFunction write_function;
+
+public:
+  FunctionMemory(ReadFunction read, WriteFunction write) noexcept;
+
+  uint8_t read(uint16_t address) noexcept;
+  void write(uint16_t address, uint8_t value) noexcept;
+};
+
+template <typename BusT> class CPU : public Registers {
+  // Native code works on the registers and the budget directly.
+  friend class dynarec::Recompiler<BusT>;
+
   void dump_reg() noexcept;
   void sanity() noexcept;
 
-  ReadFunction read;
-  WriteFunction write;
+  BusT &bus;
+
+  uint8_t read(uint16_t address) noexcept { return bus.read(address); }
+  void write(uint16_t address, uint8_t value) noexcept {
+    bus.write(address, value);
+  }
   // Fetched value for the ALU.
   uint8_t fetched = 0;
   // Absolute address to jump to / fetch a value from.
   uint16_t addr_abs = 0;
   // Relative address to jump to.
   uint16_t addr_rel = 0;
-  const op::Opcode *decoded_opcode;
+  // Cycles left in the current `run`.
+  int budget = 0;
+
+  // Every opcode gets a handler of its own, stamped out of its entry in
+  // `op::opcodes`. Its addressing mode, operation, cycles and page penalty are
+  // all constants in there, so the only branch left is picking the handler.
+  // Cached handlers take their operand from `operand` instead of the bus.
+  using Handler = void (CPU::*)() noexcept;
+  template <uint8_t opcode, bool cached> void instruction() noexcept;
+  template <bool cached, size_t... opcodes>
+  constexpr static std::array<Handler, 256>
+  make_handlers(std::index_sequence<opcodes...>) noexcept;
+  const static std::array<Handler, 256> handlers;
+  const static std::array<Handler, 256> cached_handlers;
+
+  // Instructions out of ROM, decoded once. A block runs up to the first
+  // instruction that changes the flow, and never crosses a page.
+  struct CachedInstruction {
+    Handler handler;
+    uint16_t operand;
+    uint8_t opcode;
+  };
+
+  const static auto max_block_size = 16;
+  const static auto block_cache_size = 1024;
+
+  struct Block {
+    // Where the block starts in host memory, which says which bank it is in.
+    const uint8_t *code = nullptr;
+    uint8_t size = 0;
+    // Only reads stable memory, and ends in a branch back to its start (or a
+    // jump, which might be). Such a block may be an idle loop.
+    bool idle = false;
+    std::array<CachedInstruction, max_block_size> instructions;
+  };
+
+  // Direct mapped, by where the block starts. Only buses with ROM get one.
+  std::vector<Block> blocks;
+  // Operand of the cached instruction being executed.
+  uint16_t operand = 0;
+
+  // Run the cached block at PC, if PC is in ROM. Returns whether it did.
+  bool run_block() noexcept
+    requires CodeMemory<BusT>;
+  void compile_block(Block &block, std::span<const uint8_t> code) noexcept
+    requires CodeMemory<BusT>;
+  // Whether the block, `length` bytes long, may be an idle loop.
+  bool idle_block(const Block &block, size_t length) noexcept
+    requires IdleMemory<BusT>;
+  // The block at `start.pc` just ran once. If it came back to where it started
+  // with the same registers, skip the iterations that would do the same again.
+  void skip_idle(const Registers &start, uint16_t start_nz,
+                 uint64_t start_clock) noexcept;
+  // The bytes after the opcode.
+  template <bool cached> uint8_t operand8() noexcept;
+  template <bool cached> uint16_t operand16() noexcept;
 
   // Compute addresses and stuff using the addressing mode.
-  void addressing_mode(op::AddressingMode mode) noexcept;
+  template <op::AddressingMode mode, bool page_penalty, bool cached>
+  void addressing_mode() noexcept;
   // Execute the actual instruction.
-  void execute(op::Op op) noexcept;
+  template <op::Op operation, op::AddressingMode mode>
+  void execute() noexcept;
+
+  // N and Z, evaluated lazily. Most results get overwritten before a branch
+  // or a push looks at them, so instructions only keep the byte they come
+  // from, and `p` only gets them when something reads it. N is bit 7, or bit 8
+  // on its own (BIT and PLP can set N on a zero byte).
+  uint16_t nz = 0;
 
-  // Compute the negative flag.
-  void flag_negative(uint16_t result) noexcept;
-  // Compute the zero flag.
-  void flag_zero(uint16_t result) noexcept;
+  // Compute the negative and zero flags, lazily.
+  void flag_nz(uint16_t result) noexcept;
   // Compute the carry flag.
   void flag_carry(uint16_t result) noexcept;
+  [[nodiscard]] bool negative() const noexcept;
+  [[nodiscard]] bool zero() const noexcept;
+  // Write N and Z out to `p`.
+  void pack_flags() noexcept;
+  // Pick N and Z up from `p`, after it got written from the outside.
+  void unpack_flags() noexcept;
 
   // Fetch the value from the addr_abs.
-  void fetch() noexcept;
+  template <op::AddressingMode mode> void fetch() noexcept;
 
   // Branch using addr_rel.
   void branch() noexcept;
@@ -82,24 +213,51 @@ class CPU : public Registers {
   // Performs an interrupt using the provided interrupt vector.
   void interrupt(uint16_t vector) noexcept;
 
+  // Execute the instruction at PC, leaving N and Z lazy.
+  int next_instruction() noexcept;
+
   void push(uint8_t value) noexcept;
   void push_pc() noexcept;
   uint8_t pop() noexcept;
   void pop_pc() noexcept;
 
 public:
-  CPU(ReadFunction read, WriteFunction write) noexcept;
+  explicit CPU(BusT &bus) noexcept;
   ~CPU() noexcept;
 
   void dump_state() noexcept;
 
   // Number of cycles waiting to execute before we can execute the next opcode.
   int pending_cycles = 0;
+  // CPU cycle at which the next instruction starts. Everything that takes CPU
+  // time (instructions, interrupts, resets, DMA stalls) pushes this forward.
+  uint64_t clock = 0;
   // Opcode that is being currently executed.
   uint8_t opcode = 0;
 
+  // Block cache counters. Misses are blocks we had to decode, uncached are
+  // instructions that ran from outside ROM.
+  uint64_t block_hits = 0;
+  uint64_t block_misses = 0;
+  uint64_t uncached_instructions = 0;
+
+  // Skip whole iterations of loops that only wait for the next event (the
+  // vblank flag, or a flag in RAM the NMI handler sets), up to the end of the
+  // budget. Exact, but it needs an `IdleMemory` bus.
+  bool skip_idle_loops = false;
+  // Cycles the skipped iterations took.
+  uint64_t skipped_cycles = 0;
+
   // Reset the CPU.
   void rst() noexcept;
+  // Execute a whole instruction right away, and return the number of cycles it
+  // took.
+  int step() noexcept;
+  // Execute whole instructions back-to-back until the cycle budget runs out,
+  // and return the number of cycles we overshot it by.
+  int run(int cycle_budget) noexcept;
+  // Make `run` return as soon as the current instruction completes.
+  void yield() noexcept;
   // Simulate a clock tick. Maybe a NOP depending on the number of pending
   // cycles.
   void tick() noexcept;
@@ -107,6 +265,9 @@ public:
   void irq() noexcept;
   // Send a non-maskable interrupt.
   void nmi() noexcept;
+
+  void save(CPUState &state) const noexcept;
+  void load(const CPUState &state) noexcept;
 };
 } // namespace nes::cpu
 
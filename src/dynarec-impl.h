@@ -0,0 +1,420 @@
+#ifndef NES_DYNAREC_IMPL_H
+#define NES_DYNAREC_IMPL_H
+
+// Definitions of the recompiler members. Like the CPU, it is templated on the
+// bus, and instantiated next to it.
+
+#include <algorithm>
+#include <memory>
+
+#include <spdlog/spdlog.h>
+
+#include "cpu-impl.h"
+#include "dynarec.h"
+
+namespace nes::cpu::dynarec {
+extern std::shared_ptr<spdlog::logger> logger;
+
+template <typename BusT>
+Recompiler<BusT>::Recompiler(CPU<BusT> &cpu, BusT &bus, Mode mode) noexcept
+    : cpu(cpu), bus(bus), arena(16 << 20), entries(table_size), mode(mode) {
+  static_assert(RecompilableMemory<BusT>,
+                "The recompiler needs to know where ROM and RAM are.");
+
+  auto offset = [&](const void *field) {
+    return (int32_t)((const uint8_t *)field - (const uint8_t *)&cpu);
+  };
+
+  a = offset(&cpu.a);
+  x = offset(&cpu.x);
+  y = offset(&cpu.y);
+  sp = offset(&cpu.sp);
+  pc = offset(&cpu.pc);
+  p = offset(&cpu.p);
+  nz = offset(&cpu.nz);
+  opcode = offset(&cpu.opcode);
+  pending_cycles = offset(&cpu.pending_cycles);
+  clock = offset(&cpu.clock);
+  budget = offset(&cpu.budget);
+
+#ifndef NES_DYNAREC
+  if (mode != Mode::Off)
+    logger->warn("No recompiler for this platform, using the interpreter.");
+#endif
+}
+
+template <typename BusT>
+template <uint8_t opcode>
+bool Recompiler<BusT>::instruction(CPU<BusT> *cpu, uint32_t generation,
+                                   uint16_t operand) noexcept {
+  // Same as an instruction of `CPU::run_block`.
+  cpu->opcode = opcode;
+  cpu->operand = operand;
+  cpu->pc++;
+
+  cpu->template instruction<opcode, true>();
+  cpu->status._ = 1;
+
+  cpu->clock += cpu->pending_cycles;
+  cpu->budget -= cpu->pending_cycles;
+
+  return cpu->budget <= 0 || cpu->bus.code_generation() != generation;
+}
+
+template <typename BusT>
+template <size_t... opcodes>
+constexpr std::array<typename Recompiler<BusT>::Trampoline, 256>
+Recompiler<BusT>::make_trampolines(std::index_sequence<opcodes...>) noexcept {
+  return {&Recompiler::instruction<opcodes>...};
+}
+
+template <typename BusT>
+constinit const std::array<typename Recompiler<BusT>::Trampoline, 256>
+    Recompiler<BusT>::trampolines =
+        make_trampolines(std::make_index_sequence<256>());
+
+template <typename BusT> void Recompiler<BusT>::emit_flags_nz() noexcept {
+  // Lazy, like the interpreter.
+  assembler.movzx_eax_al();
+  assembler.store16_ax(nz);
+}
+
+template <typename BusT>
+bool Recompiler<BusT>::emit_native(uint8_t opcode, uint16_t operand) noexcept {
+  auto &as = assembler;
+  using A = Assembler;
+  using op::AddressingMode;
+  using op::Op;
+
+  auto &decoded = op::opcodes[opcode];
+  auto mode = decoded.mode;
+  auto value = (uint8_t)operand;
+
+  // RAM the instruction reads or writes, if it goes straight to RAM.
+  uint8_t *ram = nullptr;
+  if (mode == AddressingMode::ZeroPage)
+    ram = bus.ram(operand & 0xff);
+  else if (mode == AddressingMode::Absolute)
+    ram = bus.ram(operand);
+
+  auto transfer = [&](int32_t from, int32_t to, bool flags) {
+    as.load8(A::al, from);
+    as.store8(to, A::al);
+    if (flags)
+      emit_flags_nz();
+  };
+
+  auto step = [&](int32_t reg, bool increment) {
+    as.load8(A::al, reg);
+    if (increment)
+      as.inc_al();
+    else
+      as.dec_al();
+    as.store8(reg, A::al);
+    emit_flags_nz();
+  };
+
+  auto load = [&](int32_t reg) {
+    if (mode == AddressingMode::Immediate) {
+      as.store_imm8(reg, value);
+      as.store_imm16(nz, value);
+      return true;
+    }
+
+    if (ram == nullptr)
+      return false;
+
+    as.mov_rax((uint64_t)ram);
+    as.load8_rax(A::al);
+    as.store8(reg, A::al);
+    emit_flags_nz();
+    return true;
+  };
+
+  auto store = [&](int32_t reg) {
+    if (ram == nullptr)
+      return false;
+
+    // The pointer goes in first, al is the low byte of rax.
+    as.mov_rax((uint64_t)ram);
+    as.load8(A::cl, reg);
+    as.store8_rax(A::cl);
+    return true;
+  };
+
+  auto logic = [&](Op operation) {
+    if (mode != AddressingMode::Immediate)
+      return false;
+
+    as.load8(A::al, a);
+    if (operation == Op::AND)
+      as.and_al(value);
+    else if (operation == Op::ORA)
+      as.or_al(value);
+    else
+      as.xor_al(value);
+    as.store8(a, A::al);
+    emit_flags_nz();
+    return true;
+  };
+
+  auto compare = [&](int32_t reg) {
+    if (mode != AddressingMode::Immediate)
+      return false;
+
+    // C is "no borrow", N and Z come from the difference.
+    as.load8(A::al, reg);
+    as.sub_al(value);
+    as.setcc_dl(A::above_equal);
+    as.load8(A::cl, p);
+    as.and_cl(0xfe);
+    as.or_cl_dl();
+    as.store8(p, A::cl);
+    emit_flags_nz();
+    return true;
+  };
+
+  switch (decoded.operation) {
+  case Op::LDA: return load(a);
+  case Op::LDX: return load(x);
+  case Op::LDY: return load(y);
+  case Op::STA: return store(a);
+  case Op::STX: return store(x);
+  case Op::STY: return store(y);
+  case Op::TAX: transfer(a, x, true); return true;
+  case Op::TAY: transfer(a, y, true); return true;
+  case Op::TXA: transfer(x, a, true); return true;
+  case Op::TYA: transfer(y, a, true); return true;
+  case Op::TSX: transfer(sp, x, true); return true;
+  case Op::TXS: transfer(x, sp, false); return true;
+  case Op::INX: step(x, true); return true;
+  case Op::INY: step(y, true); return true;
+  case Op::DEX: step(x, false); return true;
+  case Op::DEY: step(y, false); return true;
+  case Op::AND:
+  case Op::ORA:
+  case Op::EOR: return logic(decoded.operation);
+  case Op::CMP: return compare(a);
+  case Op::CPX: return compare(x);
+  case Op::CPY: return compare(y);
+  case Op::CLC: as.and_imm8(p, 0xfe); return true;
+  case Op::SEC: as.or_imm8(p, 0x01); return true;
+  case Op::CLI: as.and_imm8(p, 0xfb); return true;
+  case Op::SEI: as.or_imm8(p, 0x04); return true;
+  case Op::CLD: as.and_imm8(p, 0xf7); return true;
+  case Op::SED: as.or_imm8(p, 0x08); return true;
+  case Op::CLV: as.and_imm8(p, 0xbf); return true;
+  // Others read memory, which might be I/O.
+  case Op::NOP: return mode == AddressingMode::Implicit;
+  default: return false;
+  }
+}
+
+template <typename BusT>
+void Recompiler<BusT>::compile(Entry &entry,
+                               std::span<const uint8_t> code) noexcept {
+#ifdef NES_DYNAREC
+  Block block;
+  cpu.compile_block(block, code);
+  if (block.size == 0)
+    return;
+
+  // Idle loops are better off skipped than run faster, leave them to the CPU.
+  if (cpu.skip_idle_loops && block.idle)
+    return;
+
+  auto &as = assembler;
+  using A = Assembler;
+
+  // Native instructions that haven't made it to the CPU yet.
+  struct Pending {
+    int pc = 0;
+    int cycles = 0;
+    uint8_t opcode = 0;
+    int last_cycles = 0;
+  };
+
+  // Leaving early, when the budget runs out after a native instruction.
+  struct Exit {
+    size_t fixup;
+    Pending pending;
+  };
+
+  auto write_back = [&](const Pending &pending) {
+    if (pending.cycles == 0)
+      return;
+
+    as.add_imm16(pc, pending.pc);
+    as.add_imm64(clock, pending.cycles);
+    as.sub_imm32(budget, pending.cycles);
+    as.store_imm8(opcode, pending.opcode);
+    as.store_imm32(pending_cycles, pending.last_cycles);
+    as.or_imm8(p, 0x20);
+  };
+
+  std::vector<size_t> to_epilogue;
+  std::vector<Exit> exits;
+  Pending pending;
+
+  as.clear();
+  as.prologue();
+
+  for (uint8_t i = 0; i < block.size; i++) {
+    auto &instruction = block.instructions[i];
+    auto &decoded = op::opcodes[instruction.opcode];
+    auto last = i + 1 == block.size;
+
+    if (emit_native(instruction.opcode, instruction.operand)) {
+      pending.pc += op::length(decoded.mode);
+      pending.cycles += decoded.cycles;
+      pending.opcode = instruction.opcode;
+      pending.last_cycles = decoded.cycles;
+
+      // The budget in the CPU is from the last write back.
+      if (!last) {
+        as.cmp_imm32(budget, pending.cycles);
+        exits.push_back(Exit{.fixup = as.jcc(A::less_equal),
+                             .pending = pending});
+      }
+      continue;
+    }
+
+    write_back(pending);
+    pending = Pending{};
+
+    as.call((uint64_t)trampolines[instruction.opcode], instruction.operand);
+    if (!last) {
+      as.test_al();
+      to_epilogue.push_back(as.jcc(A::not_equal));
+    }
+  }
+
+  write_back(pending);
+
+  auto epilogue = as.here();
+  as.epilogue();
+
+  for (auto &exit : exits) {
+    as.bind(exit.fixup, as.here());
+    write_back(exit.pending);
+    to_epilogue.push_back(as.jmp());
+  }
+
+  for (auto fixup : to_epilogue)
+    as.bind(fixup, epilogue);
+
+  auto function = arena.add(as.code());
+  if (function == nullptr) {
+    // Full, start over. Whatever is still hot gets compiled again.
+    logger->debug("Native code arena is full, flushing it.");
+    arena.clear();
+    std::fill(entries.begin(), entries.end(), Entry{});
+    entry.code = code.data();
+
+    function = arena.add(as.code());
+    if (function == nullptr)
+      return;
+  }
+
+  entry.function = (BlockFunction)function;
+  compiled_blocks++;
+#endif
+}
+
+template <typename BusT>
+void Recompiler<BusT>::run_native(const Entry &entry) noexcept {
+  entry.function(&cpu, bus.code_generation());
+  native_runs++;
+}
+
+template <typename BusT>
+void Recompiler<BusT>::run_differential(const Entry &entry) noexcept {
+  if constexpr (SnapshotMemory<BusT>) {
+    if (!before)
+      before = std::make_unique_for_overwrite<typename BusT::Snapshot>();
+
+    // Snapshots take `p` as it is, so N and Z have to be in it.
+    cpu.pack_flags();
+    bus.save(*before);
+    auto start_pc = cpu.pc;
+    auto start_budget = cpu.budget;
+
+    run_native(entry);
+    cpu.pack_flags();
+    CPUState native{};
+    cpu.save(native);
+    auto native_budget = cpu.budget;
+
+    // Again, on the interpreter, which is what we keep.
+    bus.load(*before);
+    cpu.budget = start_budget;
+    cpu.run_block();
+    cpu.pack_flags();
+    CPUState reference{};
+    cpu.save(reference);
+
+    auto &n = native.registers;
+    auto &r = reference.registers;
+    if (n.a != r.a || n.x != r.x || n.y != r.y || n.sp != r.sp ||
+        n.pc != r.pc || n.p != r.p || native.clock != reference.clock ||
+        native.pending_cycles != reference.pending_cycles ||
+        native.opcode != reference.opcode || native_budget != cpu.budget) {
+      logger->error("Native block at {:#06x} diverged from the interpreter",
+                    start_pc);
+      logger->error("  native: a={:#04x} x={:#04x} y={:#04x} sp={:#04x} "
+                    "pc={:#06x} p={:#04x} clock={} budget={}",
+                    n.a, n.x, n.y, n.sp, n.pc, n.p, native.clock,
+                    native_budget);
+      logger->error("  interpreter: a={:#04x} x={:#04x} y={:#04x} sp={:#04x} "
+                    "pc={:#06x} p={:#04x} clock={} budget={}",
+                    r.a, r.x, r.y, r.sp, r.pc, r.p, reference.clock,
+                    cpu.budget);
+      mismatches++;
+    }
+  } else {
+    run_native(entry);
+  }
+}
+
+template <typename BusT>
+int Recompiler<BusT>::run(int cycle_budget) noexcept {
+  if (mode == Mode::Off)
+    return cpu.run(cycle_budget);
+
+  cpu.budget = cycle_budget;
+  cpu.unpack_flags();
+
+  while (cpu.budget > 0) {
+    auto code = bus.rom_code(cpu.pc);
+
+    if (!code.empty()) {
+      auto key = (uintptr_t)code.data();
+      auto &entry = entries[(key ^ (key >> 12)) & (table_size - 1)];
+
+      if (entry.code != code.data())
+        entry = Entry{.code = code.data()};
+
+      if (entry.function == nullptr && entry.runs++ == hot_threshold)
+        compile(entry, code);
+
+      if (entry.function != nullptr) {
+        if (mode == Mode::Differential)
+          run_differential(entry);
+        else
+          run_native(entry);
+        continue;
+      }
+    }
+
+    if (!cpu.run_block()) {
+      cpu.budget -= cpu.next_instruction();
+      cpu.uncached_instructions++;
+    }
+  }
+
+  cpu.pack_flags();
+  return -cpu.budget;
+}
+} // namespace nes::cpu::dynarec
+
+#endif // NES_DYNAREC_IMPL_H
@@ -0,0 +1,250 @@
+#include <cerrno>
+#include <cstring>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "dynarec.h"
+
+// Only now do we know whether there's a recompiler.
+#ifdef NES_DYNAREC
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace nes::cpu::dynarec {
+std::shared_ptr<spdlog::logger> logger =
+    spdlog::stderr_color_mt("nes::cpu::dynarec");
+
+Arena::Arena(size_t size) noexcept : size(size) {
+#ifdef NES_DYNAREC
+  auto mapped = mmap(nullptr, size, PROT_READ | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) {
+    logger->error("Couldn't map {} bytes for native code: {}", size,
+                  strerror(errno));
+    return;
+  }
+
+  memory = (uint8_t *)mapped;
+#endif
+}
+
+Arena::~Arena() noexcept {
+#ifdef NES_DYNAREC
+  if (memory != nullptr)
+    munmap(memory, size);
+#endif
+}
+
+const uint8_t *Arena::add(std::span<const uint8_t> code) noexcept {
+#ifdef NES_DYNAREC
+  if (memory == nullptr || used + code.size() > size)
+    return nullptr;
+
+  // Only the pages the code lands on have to change.
+  auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+  auto start = used & ~(page_size - 1);
+  auto length = used + code.size() - start;
+
+  if (mprotect(memory + start, length, PROT_READ | PROT_WRITE) != 0) {
+    logger->error("Couldn't make native code writable: {}", strerror(errno));
+    return nullptr;
+  }
+
+  auto added = memory + used;
+  std::memcpy(added, code.data(), code.size());
+  mprotect(memory + start, length, PROT_READ | PROT_EXEC);
+
+  // Start every block on a fresh cache line.
+  used = (used + code.size() + 63) & ~(size_t)63;
+  return added;
+#else
+  return nullptr;
+#endif
+}
+
+void Arena::clear() noexcept { used = 0; }
+
+void Assembler::emit(std::initializer_list<uint8_t> code) noexcept {
+  bytes.insert(bytes.end(), code);
+}
+
+void Assembler::emit8(uint8_t value) noexcept { bytes.push_back(value); }
+
+void Assembler::emit16(uint16_t value) noexcept {
+  emit8(value & 0xff);
+  emit8(value >> 8);
+}
+
+void Assembler::emit32(uint32_t value) noexcept {
+  emit16(value & 0xffff);
+  emit16(value >> 16);
+}
+
+void Assembler::emit64(uint64_t value) noexcept {
+  emit32(value & 0xffffffff);
+  emit32(value >> 32);
+}
+
+void Assembler::cpu_operand(uint8_t reg, int32_t disp) noexcept {
+  // mod = 10 (disp32), rm = 011 (rbx).
+  emit8(0x80 | (reg << 3) | 0x3);
+  emit32(disp);
+}
+
+std::span<const uint8_t> Assembler::code() const noexcept { return bytes; }
+
+size_t Assembler::here() const noexcept { return bytes.size(); }
+
+void Assembler::clear() noexcept { bytes.clear(); }
+
+void Assembler::prologue() noexcept {
+  emit({0x53});                   // push rbx
+  emit({0x41, 0x54});             // push r12
+  emit({0x48, 0x83, 0xec, 0x08}); // sub rsp, 8
+  emit({0x48, 0x89, 0xfb});       // mov rbx, rdi
+  emit({0x41, 0x89, 0xf4});       // mov r12d, esi
+}
+
+void Assembler::epilogue() noexcept {
+  emit({0x48, 0x83, 0xc4, 0x08}); // add rsp, 8
+  emit({0x41, 0x5c});             // pop r12
+  emit({0x5b});                   // pop rbx
+  emit({0xc3});                   // ret
+}
+
+void Assembler::load8(uint8_t reg, int32_t disp) noexcept {
+  emit8(0x8a);
+  cpu_operand(reg, disp);
+}
+
+void Assembler::store8(int32_t disp, uint8_t reg) noexcept {
+  emit8(0x88);
+  cpu_operand(reg, disp);
+}
+
+void Assembler::store16_ax(int32_t disp) noexcept {
+  emit({0x66, 0x89});
+  cpu_operand(al, disp);
+}
+
+void Assembler::store_imm8(int32_t disp, uint8_t value) noexcept {
+  emit8(0xc6);
+  cpu_operand(0, disp);
+  emit8(value);
+}
+
+void Assembler::store_imm16(int32_t disp, uint16_t value) noexcept {
+  emit({0x66, 0xc7});
+  cpu_operand(0, disp);
+  emit16(value);
+}
+
+void Assembler::store_imm32(int32_t disp, uint32_t value) noexcept {
+  emit8(0xc7);
+  cpu_operand(0, disp);
+  emit32(value);
+}
+
+void Assembler::and_imm8(int32_t disp, uint8_t value) noexcept {
+  emit8(0x80);
+  cpu_operand(4, disp);
+  emit8(value);
+}
+
+void Assembler::or_imm8(int32_t disp, uint8_t value) noexcept {
+  emit8(0x80);
+  cpu_operand(1, disp);
+  emit8(value);
+}
+
+void Assembler::add_imm16(int32_t disp, uint16_t value) noexcept {
+  emit({0x66, 0x81});
+  cpu_operand(0, disp);
+  emit16(value);
+}
+
+void Assembler::add_imm64(int32_t disp, int32_t value) noexcept {
+  emit({0x48, 0x81});
+  cpu_operand(0, disp);
+  emit32(value);
+}
+
+void Assembler::sub_imm32(int32_t disp, int32_t value) noexcept {
+  emit8(0x81);
+  cpu_operand(5, disp);
+  emit32(value);
+}
+
+void Assembler::cmp_imm32(int32_t disp, int32_t value) noexcept {
+  emit8(0x81);
+  cpu_operand(7, disp);
+  emit32(value);
+}
+
+void Assembler::mov_rax(uint64_t value) noexcept {
+  emit({0x48, 0xb8});
+  emit64(value);
+}
+
+void Assembler::load8_rax(uint8_t reg) noexcept {
+  emit({0x8a, (uint8_t)(reg << 3)});
+}
+
+void Assembler::store8_rax(uint8_t reg) noexcept {
+  emit({0x88, (uint8_t)(reg << 3)});
+}
+
+void Assembler::inc_al() noexcept { emit({0xfe, 0xc0}); }
+
+void Assembler::dec_al() noexcept { emit({0xfe, 0xc8}); }
+
+void Assembler::and_al(uint8_t value) noexcept { emit({0x24, value}); }
+
+void Assembler::or_al(uint8_t value) noexcept { emit({0x0c, value}); }
+
+void Assembler::xor_al(uint8_t value) noexcept { emit({0x34, value}); }
+
+void Assembler::sub_al(uint8_t value) noexcept { emit({0x2c, value}); }
+
+void Assembler::test_al() noexcept { emit({0x84, 0xc0}); }
+
+void Assembler::movzx_eax_al() noexcept { emit({0x0f, 0xb6, 0xc0}); }
+
+void Assembler::setcc_dl(uint8_t condition) noexcept {
+  emit({0x0f, (uint8_t)(0x90 | condition), 0xc2});
+}
+
+void Assembler::or_cl_dl() noexcept { emit({0x08, 0xd1}); }
+
+void Assembler::and_cl(uint8_t value) noexcept {
+  emit({0x80, 0xe1, value});
+}
+
+void Assembler::call(uint64_t function, uint16_t operand) noexcept {
+  emit({0x48, 0x89, 0xdf}); // mov rdi, rbx
+  emit({0x44, 0x89, 0xe6}); // mov esi, r12d
+  emit({0xba});             // mov edx, operand
+  emit32(operand);
+  mov_rax(function);
+  emit({0xff, 0xd0}); // call rax
+}
+
+size_t Assembler::jcc(uint8_t condition) noexcept {
+  emit({0x0f, (uint8_t)(0x80 | condition)});
+  emit32(0);
+  return here() - 4;
+}
+
+size_t Assembler::jmp() noexcept {
+  emit8(0xe9);
+  emit32(0);
+  return here() - 4;
+}
+
+void Assembler::bind(size_t fixup, size_t target) noexcept {
+  auto rel = (int32_t)(target - (fixup + 4));
+  std::memcpy(&bytes[fixup], &rel, sizeof(rel));
+}
+} // namespace nes::cpu::dynarec
@@ -0,0 +1,226 @@
+#ifndef NES_DYNAREC_H
+#define NES_DYNAREC_H
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <span>
+#include <variant>
+#include <vector>
+
+#include "cpu.h"
+
+// The recompiler emits x86-64 code for the System V calling convention, and
+// needs mmap to get memory it can run. Everywhere else it runs the interpreter.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) &&      \
+    !defined(NES_NO_DYNAREC)
+#define NES_DYNAREC
+#endif
+
+namespace nes::cpu::dynarec {
+enum class Mode {
+  Off,
+  // Hot blocks run as native code.
+  On,
+  // Every native block also runs on the interpreter, from a snapshot of the
+  // machine, and the registers they end up with get compared. Slow, for
+  // catching recompiler bugs.
+  Differential,
+};
+
+// Memory the recompiler can translate code for. On top of ROM, it needs to
+// know where plain RAM lives in host memory (RAM that never gets remapped, and
+// has no side effects), so loads and stores to it can skip the bus.
+template <typename T>
+concept RecompilableMemory =
+    CodeMemory<T> && requires(T &memory, uint16_t address) {
+      { memory.ram(address) } -> std::same_as<uint8_t *>;
+    };
+
+// Memory that can snapshot the whole machine, for differential runs.
+template <typename T>
+concept SnapshotMemory = requires(T &memory, typename T::Snapshot &snapshot) {
+  memory.save(snapshot);
+  { memory.load(snapshot) } -> std::same_as<bool>;
+};
+
+// The snapshot type of memory that has one.
+template <typename T> struct SnapshotOf {
+  using type = std::monostate;
+};
+template <SnapshotMemory T> struct SnapshotOf<T> {
+  using type = typename T::Snapshot;
+};
+
+// Memory for native code. It is mapped once, and filled from the start until
+// it runs out. It is never writable and executable at once.
+class Arena {
+  uint8_t *memory = nullptr;
+  size_t size;
+  size_t used = 0;
+
+public:
+  explicit Arena(size_t size) noexcept;
+  ~Arena() noexcept;
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Copy code in. Returns where it ended up, or nullptr if it doesn't fit.
+  const uint8_t *add(std::span<const uint8_t> code) noexcept;
+  // Forget everything in it.
+  void clear() noexcept;
+};
+
+// Just enough of an x86-64 assembler for the recompiler. Memory operands are
+// all relative to rbx, which holds the CPU, with 32-bit displacements.
+class Assembler {
+  std::vector<uint8_t> bytes;
+
+  void emit(std::initializer_list<uint8_t> code) noexcept;
+  void emit8(uint8_t value) noexcept;
+  void emit16(uint16_t value) noexcept;
+  void emit32(uint32_t value) noexcept;
+  void emit64(uint64_t value) noexcept;
+  // ModRM for [rbx + disp32].
+  void cpu_operand(uint8_t reg, int32_t disp) noexcept;
+
+public:
+  // 8-bit registers, as encoded.
+  const static uint8_t al = 0;
+  const static uint8_t cl = 1;
+  const static uint8_t dl = 2;
+
+  // Condition codes, as encoded in Jcc / SETcc.
+  const static uint8_t above_equal = 0x3;
+  const static uint8_t equal = 0x4;
+  const static uint8_t not_equal = 0x5;
+  const static uint8_t less_equal = 0xe;
+
+  [[nodiscard]] std::span<const uint8_t> code() const noexcept;
+  [[nodiscard]] size_t here() const noexcept;
+  void clear() noexcept;
+
+  // push rbx, r12 and keep the stack aligned. rbx = CPU, r12d = generation.
+  void prologue() noexcept;
+  void epilogue() noexcept;
+
+  void load8(uint8_t reg, int32_t disp) noexcept;
+  void store8(int32_t disp, uint8_t reg) noexcept;
+  void store16_ax(int32_t disp) noexcept;
+  void store_imm8(int32_t disp, uint8_t value) noexcept;
+  void store_imm16(int32_t disp, uint16_t value) noexcept;
+  void store_imm32(int32_t disp, uint32_t value) noexcept;
+  void and_imm8(int32_t disp, uint8_t value) noexcept;
+  void or_imm8(int32_t disp, uint8_t value) noexcept;
+  void add_imm16(int32_t disp, uint16_t value) noexcept;
+  void add_imm64(int32_t disp, int32_t value) noexcept;
+  void sub_imm32(int32_t disp, int32_t value) noexcept;
+  void cmp_imm32(int32_t disp, int32_t value) noexcept;
+
+  // Loads and stores through a host pointer, in rax.
+  void mov_rax(uint64_t value) noexcept;
+  void load8_rax(uint8_t reg) noexcept;
+  void store8_rax(uint8_t reg) noexcept;
+
+  // ALU ops on al.
+  void inc_al() noexcept;
+  void dec_al() noexcept;
+  void and_al(uint8_t value) noexcept;
+  void or_al(uint8_t value) noexcept;
+  void xor_al(uint8_t value) noexcept;
+  void sub_al(uint8_t value) noexcept;
+  void test_al() noexcept;
+  void movzx_eax_al() noexcept;
+  void setcc_dl(uint8_t condition) noexcept;
+  void or_cl_dl() noexcept;
+  void and_cl(uint8_t value) noexcept;
+
+  // Call fn(rbx, r12d, operand).
+  void call(uint64_t function, uint16_t operand) noexcept;
+
+  // Jumps to be patched once the target is known. Return the fixup.
+  size_t jcc(uint8_t condition) noexcept;
+  size_t jmp() noexcept;
+  void bind(size_t fixup, size_t target) noexcept;
+};
+
+// Translates hot blocks of ROM code into x86-64. The CPU's interpreter stays
+// the reference: the native code is built out of the same blocks as its block
+// cache, only does natively what's simple to get exactly right (loads, stores
+// and ALU ops on RAM and registers), and calls back into the interpreter's
+// handlers for the rest, I/O and all. The CPU clock, PC and cycle budget are
+// only written back when leaving a block, or before calling out.
+//
+// Not thread safe, every CPU gets its own.
+template <typename BusT> class Recompiler {
+  using Block = typename CPU<BusT>::Block;
+  // Runs a block. Takes the code generation it got entered with.
+  using BlockFunction = void (*)(CPU<BusT> *cpu, uint32_t generation);
+  // Runs an instruction through the interpreter. Returns whether the block
+  // has to stop, after it.
+  using Trampoline = bool (*)(CPU<BusT> *cpu, uint32_t generation,
+                              uint16_t operand);
+
+  const static auto table_size = 4096;
+
+  struct Entry {
+    const uint8_t *code = nullptr;
+    BlockFunction function = nullptr;
+    uint32_t runs = 0;
+  };
+
+  CPU<BusT> &cpu;
+  BusT &bus;
+
+  Arena arena;
+  Assembler assembler;
+  // Direct mapped, by where the block starts, like the block cache.
+  std::vector<Entry> entries;
+
+  // Where the registers live in the CPU, for native code.
+  int32_t a, x, y, sp, pc, p, nz, opcode, pending_cycles, clock, budget;
+
+  template <uint8_t opcode>
+  static bool instruction(CPU<BusT> *cpu, uint32_t generation,
+                          uint16_t operand) noexcept;
+  template <size_t... opcodes>
+  constexpr static std::array<Trampoline, 256>
+  make_trampolines(std::index_sequence<opcodes...>) noexcept;
+  const static std::array<Trampoline, 256> trampolines;
+
+  void compile(Entry &entry, std::span<const uint8_t> code) noexcept;
+  // Emit a native version of the instruction, if there is one.
+  bool emit_native(uint8_t opcode, uint16_t operand) noexcept;
+  // Set N and Z from al.
+  void emit_flags_nz() noexcept;
+
+  void run_native(const Entry &entry) noexcept;
+  void run_differential(const Entry &entry) noexcept;
+  // The machine before a differential run. Big, so it is only allocated once,
+  // by the first one.
+  std::unique_ptr<typename SnapshotOf<BusT>::type> before;
+
+public:
+  Mode mode;
+  // Times a block runs on the interpreter before it gets translated.
+  uint32_t hot_threshold = 8;
+
+  uint64_t compiled_blocks = 0;
+  uint64_t native_runs = 0;
+  uint64_t mismatches = 0;
+
+  Recompiler(CPU<BusT> &cpu, BusT &bus, Mode mode) noexcept;
+
+  Recompiler(const Recompiler &) = delete;
+  Recompiler &operator=(const Recompiler &) = delete;
+
+  // Same as `CPU::run`.
+  int run(int cycle_budget) noexcept;
+};
+} // namespace nes::cpu::dynarec
+
+#endif // NES_DYNAREC_H
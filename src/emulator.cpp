@@ -0,0 +1,149 @@
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "emulator.h"
+
+namespace nes::emulator {
+auto logger = spdlog::stderr_color_mt("nes::emulator");
+
+using std::chrono::steady_clock;
+
+const static auto frame_period = std::chrono::microseconds(1000000 / 60);
+
+Emulator::Emulator(const std::shared_ptr<cart::Cart> &cart) noexcept
+    : bus(cart), snapshot(std::make_unique<bus::Savestate>()),
+      previous(std::make_unique<bus::Savestate>()), run_ahead(bus) {}
+
+Emulator::~Emulator() noexcept { stop(); }
+
+void Emulator::start() noexcept {
+  if (running.exchange(true))
+    return;
+
+  logger->debug("Starting the emulator thread.");
+  thread = std::thread(&Emulator::run, this);
+}
+
+void Emulator::stop() noexcept {
+  if (!running.exchange(false))
+    return;
+
+  thread.join();
+  logger->debug("Stopped the emulator thread.");
+}
+
+void Emulator::set_input(Input input) noexcept {
+  this->input.store(input, std::memory_order_relaxed);
+}
+
+bool Emulator::update() noexcept { return frames.update(); }
+
+const Frame &Emulator::frame() const noexcept { return frames.read_buffer(); }
+
+void Emulator::run() noexcept {
+  auto next = steady_clock::now();
+  auto last_shown = next - frame_period;
+
+  while (running.load(std::memory_order_acquire)) {
+    auto input = this->input.load(std::memory_order_relaxed);
+    auto now = steady_clock::now();
+
+    if (input.turbo) {
+      // As fast as we go, nobody can see more than a frame per refresh though,
+      // the rest skip their pixels.
+      auto render = now - last_shown >= frame_period;
+      run_frame(input, render);
+
+      if (render) {
+        publish();
+        last_shown = now;
+      }
+
+      next = now;
+      continue;
+    }
+
+    if (now < next) {
+      std::this_thread::sleep_until(next);
+      continue;
+    }
+
+    // If we fell way behind (the machine was asleep, say), don't try to catch
+    // up on all of it.
+    next += frame_period;
+    if (next < now - frame_period)
+      next = now;
+
+    run_frame(input, true);
+    publish();
+    last_shown = now;
+  }
+}
+
+void Emulator::run_frame(const Input &input, bool render) noexcept {
+  // Nothing to rewind to, hold still rather than go on with the live input.
+  if (input.rewind && history.frames() < 2)
+    return;
+
+  bus.controller_1.state = input.controller_1;
+  bus.cpu.skip_idle_loops = skip_idle_loops.load(std::memory_order_relaxed);
+
+  // Rewinding goes back a frame per frame. Snapshots don't hold the screen, so
+  // go back two and replay one, with the input it had, to get the picture of
+  // where we land. Once at the oldest frame we can replay, we keep replaying
+  // it.
+  if (input.rewind) {
+    // The snapshot is always the newest frame, at the oldest it stays.
+    if (history.frames() > 2)
+      history.step_back(*snapshot);
+    history.step_back(*previous);
+
+    bus.load(*previous);
+    bus.controller_1.state = snapshot->controller_1;
+
+    bus.run_frame(render);
+  } else if (input.turbo) {
+    // No point running ahead when nobody sees most frames.
+    bus.run_frame(render);
+  } else {
+    run_ahead.frames = run_ahead_frames.load(std::memory_order_relaxed);
+    run_ahead.run_frame();
+  }
+
+  bus.ppu.frame_complete = false;
+  frames_run++;
+
+  bus.save(*snapshot);
+  history.push(*snapshot);
+}
+
+void Emulator::publish() noexcept {
+  auto &frame = frames.write_buffer();
+
+  frame.screen = bus.ppu.screen;
+
+  // The slot still holds whatever it had two frames ago, which usually is
+  // still good.
+  auto generation = bus.ppu.generation();
+  if (frame.debug_generation != generation) {
+    frame.pattern_tables[0] = bus.ppu.pattern_table(0);
+    frame.pattern_tables[1] = bus.ppu.pattern_table(1);
+    frame.palettes = bus.ppu.get_rendered_palettes();
+    frame.debug_generation = generation;
+  }
+
+  bus.cpu.save(frame.cpu);
+  frame.controller_1 = bus.controller_1;
+  frame.elapsed_cycles = bus.elapsed_cycles;
+  frame.frames_run = frames_run;
+  frame.block_hits = bus.cpu.block_hits;
+  frame.block_misses = bus.cpu.block_misses;
+  frame.skipped_cycles = bus.cpu.skipped_cycles;
+
+  frame.rewind_seconds = history.seconds();
+  frame.rewind_bytes_per_second = history.bytes_per_second();
+  frame.run_ahead_elapsed = run_ahead.elapsed;
+
+  frames.publish();
+}
+} // namespace nes::emulator
@@ -0,0 +1,137 @@
+#ifndef NES_EMULATOR_H
+#define NES_EMULATOR_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "bus.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "rewind.h"
+#include "runahead.h"
+
+namespace nes::emulator {
+// Hands values from one thread to another without either of them waiting.
+// The writer fills one slot, the reader holds on to another, and the third is
+// the newest finished value, which they swap their own slot with.
+template <typename T> class TripleBuffer {
+  // Set in `middle` when the writer left something the reader hasn't seen.
+  const static uint8_t fresh = 0x4;
+
+  std::unique_ptr<T[]> slots = std::make_unique<T[]>(3);
+  std::atomic<uint8_t> middle = 1;
+  // Only ever touched by the writer and the reader, respectively.
+  uint8_t back = 0;
+  uint8_t front = 2;
+
+public:
+  // The slot the writer is filling in.
+  T &write_buffer() noexcept { return slots[back]; }
+  // Hand the slot over, the writer gets the old middle one to fill next.
+  void publish() noexcept {
+    back = middle.exchange(back | fresh, std::memory_order_acq_rel) & 0x3;
+  }
+
+  // Take the newest value, if there is one. Returns whether there was.
+  bool update() noexcept {
+    if ((middle.load(std::memory_order_relaxed) & fresh) == 0)
+      return false;
+
+    front = middle.exchange(front, std::memory_order_acq_rel) & 0x3;
+    return true;
+  }
+  // The slot the reader is looking at.
+  [[nodiscard]] const T &read_buffer() const noexcept { return slots[front]; }
+};
+
+// What the frontend tells the emulator. Buttons are levels, only the newest
+// state of them matters, so a single atomic does instead of a queue.
+struct Input {
+  uint8_t controller_1 = 0;
+  bool rewind : 1 = false;
+  bool turbo : 1 = false;
+};
+
+static_assert(std::atomic<Input>::is_always_lock_free);
+
+// Everything the frontend gets to see of the machine, copied out every time a
+// frame is shown.
+struct Frame {
+  std::array<uint32_t, ppu::PPU::screen_width * ppu::PPU::screen_height>
+      screen{};
+  // Debug views, only copied when the PPU generation says they changed.
+  std::array<std::array<uint32_t, 128 * 128>, 2> pattern_tables{};
+  std::array<uint32_t, 8 * 4> palettes{};
+  uint64_t debug_generation = ~0ull;
+
+  cpu::CPUState cpu{};
+  controller::StandardController controller_1{};
+  uint64_t elapsed_cycles = 0;
+  // Frames run so far, rewound ones included. Unlike the cycles, it never goes
+  // back, so it's what the speed is measured with.
+  uint64_t frames_run = 0;
+  uint64_t block_hits = 0;
+  uint64_t block_misses = 0;
+  uint64_t skipped_cycles = 0;
+
+  double rewind_seconds = 0;
+  double rewind_bytes_per_second = 0;
+  std::chrono::microseconds run_ahead_elapsed{};
+};
+
+// Runs the machine on a thread of its own, so a slow swap or a GUI hitch
+// doesn't hold it back. Nothing but that thread touches the bus, the GUI gets
+// copies of whatever it shows.
+class Emulator {
+  bus::Bus bus;
+
+  // 16MB goes a long way, most frames only take a few hundred bytes.
+  rewind::RewindBuffer history{16 << 20};
+  std::unique_ptr<bus::Savestate> snapshot;
+  std::unique_ptr<bus::Savestate> previous;
+  uint64_t frames_run = 0;
+
+  runahead::RunAhead run_ahead;
+
+  std::atomic<Input> input{};
+  TripleBuffer<Frame> frames;
+
+  std::atomic<bool> running = false;
+  std::thread thread;
+
+  void run() noexcept;
+  // Run a frame with the given input, and record it.
+  void run_frame(const Input &input, bool render) noexcept;
+  // Copy the machine out for the frontend.
+  void publish() noexcept;
+
+public:
+  // Number of frames to run ahead, see `runahead::RunAhead`.
+  std::atomic<int> run_ahead_frames = 0;
+  // See `cpu::CPU::skip_idle_loops`.
+  std::atomic<bool> skip_idle_loops = false;
+
+  explicit Emulator(const std::shared_ptr<cart::Cart> &cart) noexcept;
+  ~Emulator() noexcept;
+
+  Emulator(const Emulator &) = delete;
+  Emulator &operator=(const Emulator &) = delete;
+
+  void start() noexcept;
+  void stop() noexcept;
+
+  void set_input(Input input) noexcept;
+
+  // Pick up the newest frame, if there is one. Returns whether there was.
+  bool update() noexcept;
+  // The frame picked up by the last `update`. Only the thread calling
+  // `update` may look at it.
+  [[nodiscard]] const Frame &frame() const noexcept;
+};
+} // namespace nes::emulator
+
+#endif // NES_EMULATOR_H
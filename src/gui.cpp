@@ -12,20 +12,28 @@ namespace nes::gui {
 const static auto label_color = ImVec4(1.0f, 0.3f, 0.3f, 1.0f);
 auto logger = spdlog::stderr_color_mt("nes::gui");
 
-GUI::GUI(bus::Bus &bus) noexcept
-    : bus(bus), screen(), pattern_table_left(), pattern_table_right(),
-      rendered_palette() {
+// What a real NTSC console runs at, a PPU dot per master cycle.
+const static auto master_clock_hz = ppu::PPU::dots_per_frame * 60.0988;
+
+GUI::GUI(emulator::Emulator &emulator) noexcept
+    : emulator(emulator),
+      screen(ppu::PPU::screen_width, ppu::PPU::screen_height),
+      pattern_table_left(128, 128), pattern_table_right(128, 128),
+      rendered_palette(16, 2) {
   logger->debug("Initializing GUI.");
 }
 
 void GUI::render_system_metrics() noexcept {
+  auto &frame = emulator.frame();
   auto now = high_resolution_clock::now();
   auto difference = now - last_clock_capture;
 
   using namespace std::literals;
   if ((difference / 1us) >= 1000000) {
-    elapsed_clocks_second = bus.elapsed_cycles - clocks_second_snapshot;
-    clocks_second_snapshot = bus.elapsed_cycles;
+    // Rewinding takes the cycles back, count the frames we ran instead.
+    elapsed_clocks_second = (frame.frames_run - frames_second_snapshot) *
+                            ppu::PPU::dots_per_frame;
+    frames_second_snapshot = frame.frames_run;
     last_clock_capture = now;
   }
 
@@ -33,7 +41,7 @@ void GUI::render_system_metrics() noexcept {
 
   ImGui::TextColored(label_color, "Cycles");
   ImGui::SameLine();
-  ImGui::Text("%llu", bus.elapsed_cycles);
+  ImGui::Text("%llu", frame.elapsed_cycles);
 
   auto io = ImGui::GetIO();
 
@@ -44,94 +52,143 @@ void GUI::render_system_metrics() noexcept {
   ImGui::TextColored(label_color, "Speed");
   ImGui::SameLine();
   ImGui::Text("%llu Hz", elapsed_clocks_second);
+  ImGui::SameLine();
+  ImGui::Text("(%.2fx)", (double)elapsed_clocks_second / master_clock_hz);
 
   ImGui::TextColored(label_color, "Frames");
   ImGui::SameLine();
   ImGui::Text("%d", ImGui::GetFrameCount());
 
+  auto lookups = frame.block_hits + frame.block_misses;
+  auto hit_rate =
+      lookups > 0 ? (double)frame.block_hits * 100 / (double)lookups : 0.0;
+
+  ImGui::TextColored(label_color, "Block cache");
+  ImGui::SameLine();
+  ImGui::Text("%.2f%% hits, %llu decoded", hit_rate, frame.block_misses);
+
+  ImGui::TextColored(label_color, "Idle loops");
+  ImGui::SameLine();
+  ImGui::Text("%llu cycles skipped", frame.skipped_cycles);
+
+  auto skip_idle_loops =
+      emulator.skip_idle_loops.load(std::memory_order_relaxed);
+  if (ImGui::Checkbox("Skip idle loops", &skip_idle_loops))
+    emulator.skip_idle_loops.store(skip_idle_loops, std::memory_order_relaxed);
+
+  ImGui::TextColored(label_color, "Rewind");
+  ImGui::SameLine();
+  ImGui::Text("%.1f s, %.1f kB/s", frame.rewind_seconds,
+              frame.rewind_bytes_per_second / 1024);
+
+  // All the frames we run ahead have to fit in a host frame.
+  auto run_ahead_ms =
+      std::chrono::duration<double, std::milli>(frame.run_ahead_elapsed)
+          .count();
+  auto budget = run_ahead_ms / (1000.0 / 60) * 100;
+
+  ImGui::TextColored(label_color, "Run ahead");
+  ImGui::SameLine();
+  ImGui::Text("%.2f ms, %.0f%% of a frame", run_ahead_ms, budget);
+
+  auto frames = emulator.run_ahead_frames.load(std::memory_order_relaxed);
+  if (ImGui::SliderInt("Frames", &frames, 0, 4))
+    emulator.run_ahead_frames.store(frames, std::memory_order_relaxed);
+
+  // Only what it costs us to hand the pixels over, not the copy on the GPU.
+  auto debug_upload = pattern_table_left.upload_time +
+                      pattern_table_right.upload_time +
+                      rendered_palette.upload_time;
+
+  using us = std::chrono::duration<double, std::micro>;
+
+  ImGui::TextColored(label_color, "Upload");
+  ImGui::SameLine();
+  ImGui::Text("%.1f us screen, %.1f us debug", us(screen.upload_time).count(),
+              us(debug_upload).count());
+
   ImGui::End();
 }
 
 void GUI::render_cpu_state() noexcept {
+  auto &cpu = emulator.frame().cpu;
+  auto &registers = cpu.registers;
+
   platform::imgui_begin("CPU");
 
   ImGui::TextColored(label_color, "Registers");
 
   ImGui::TextColored(label_color, "a   ");
   ImGui::SameLine();
-  ImGui::Text("%02x", bus.cpu.a);
+  ImGui::Text("%02x", registers.a);
 
   ImGui::TextColored(label_color, "x   ");
   ImGui::SameLine();
-  ImGui::Text("%02x", bus.cpu.x);
+  ImGui::Text("%02x", registers.x);
 
   ImGui::TextColored(label_color, "y   ");
   ImGui::SameLine();
-  ImGui::Text("%02x", bus.cpu.y);
+  ImGui::Text("%02x", registers.y);
 
   ImGui::TextColored(label_color, "sp  ");
   ImGui::SameLine();
-  ImGui::Text("%02x", bus.cpu.sp);
+  ImGui::Text("%02x", registers.sp);
 
   ImGui::TextColored(label_color, "pc  ");
   ImGui::SameLine();
-  ImGui::Text("%04x", bus.cpu.pc);
+  ImGui::Text("%04x", registers.pc);
 
   ImGui::TextColored(label_color, "p   ");
   ImGui::SameLine();
-  ImGui::Text("%02x", bus.cpu.p);
+  ImGui::Text("%02x", registers.p);
 
   ImGui::TextColored(label_color, "p.C ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status.C);
+  ImGui::Text("%x", registers.status.C);
 
   ImGui::TextColored(label_color, "p.Z ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status.Z);
+  ImGui::Text("%x", registers.status.Z);
 
   ImGui::TextColored(label_color, "p.I ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status.I);
+  ImGui::Text("%x", registers.status.I);
 
   ImGui::TextColored(label_color, "p.D ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status.D);
+  ImGui::Text("%x", registers.status.D);
 
   ImGui::TextColored(label_color, "p.B ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status.B);
+  ImGui::Text("%x", registers.status.B);
 
   ImGui::TextColored(label_color, "p.1 ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status._);
+  ImGui::Text("%x", registers.status._);
 
   ImGui::TextColored(label_color, "p.V ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status.V);
+  ImGui::Text("%x", registers.status.V);
 
   ImGui::TextColored(label_color, "p.N ");
   ImGui::SameLine();
-  ImGui::Text("%x", bus.cpu.status.N);
+  ImGui::Text("%x", registers.status.N);
 
   ImGui::NewLine();
   ImGui::TextColored(label_color, "System");
 
-  ImGui::TextColored(label_color, "Pending cycles");
+  ImGui::TextColored(label_color, "Clock");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.cpu.pending_cycles);
+  ImGui::Text("%llu", cpu.clock);
 
   ImGui::TextColored(label_color, "Opcode");
   ImGui::SameLine();
-  ImGui::Text("%02x", bus.cpu.opcode);
+  ImGui::Text("%02x", cpu.opcode);
 
   ImGui::End();
 }
 
 void GUI::render_ppu_state() noexcept {
-  pattern_table_left.set_data(bus.ppu.pattern_table(0), 128, 128);
-  pattern_table_right.set_data(bus.ppu.pattern_table(1), 128, 128);
-  rendered_palette.set_data(bus.ppu.get_rendered_palettes(), 16, 2);
-
   platform::imgui_begin("PPU State");
 
   const static auto patterntable_resolution = ImVec2(
@@ -151,10 +208,9 @@ void GUI::render_ppu_state() noexcept {
   ImGui::End();
 }
 
-void GUI::render_screen() const noexcept {
+void GUI::render_screen() noexcept {
   using namespace nes::ppu;
 
-  screen.set_data(bus.ppu.screen, PPU::screen_width, PPU::screen_height);
   const auto size = ImVec2(PPU::screen_width * screen_size_multiplier,
                            PPU::screen_height * screen_size_multiplier);
 
@@ -166,51 +222,74 @@ void GUI::render_screen() const noexcept {
 
   platform::imgui_begin("Display settings");
   ImGui::TextColored(label_color, "Display Scale");
-  ImGui::SliderInt("", const_cast<int *>(&screen_size_multiplier), 1, 12);
+  ImGui::SliderInt("", &screen_size_multiplier, 1, 12);
   ImGui::End();
 }
 
 void GUI::render_controller_input() const noexcept {
+  auto &controller = emulator.frame().controller_1;
+
   platform::imgui_begin("Controllers");
 
   ImGui::TextColored(label_color, "Controller 0");
 
   ImGui::TextColored(label_color, "Up");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.up);
+  ImGui::Text("%d", controller.up);
 
   ImGui::TextColored(label_color, "Down");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.down);
+  ImGui::Text("%d", controller.down);
 
   ImGui::TextColored(label_color, "Left");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.left);
+  ImGui::Text("%d", controller.left);
 
   ImGui::TextColored(label_color, "Right");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.right);
+  ImGui::Text("%d", controller.right);
 
   ImGui::TextColored(label_color, "Select");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.select);
+  ImGui::Text("%d", controller.select);
 
   ImGui::TextColored(label_color, "Start");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.start);
+  ImGui::Text("%d", controller.start);
 
   ImGui::TextColored(label_color, "A");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.a);
+  ImGui::Text("%d", controller.a);
 
   ImGui::TextColored(label_color, "B");
   ImGui::SameLine();
-  ImGui::Text("%d", bus.controller_1.b);
+  ImGui::Text("%d", controller.b);
 
   ImGui::End();
 }
 
+void GUI::upload_frame() noexcept {
+  // The emulator publishes at most one frame per emulated frame, the GUI runs
+  // at whatever the display does. Nothing to upload in between.
+  if (!emulator.update())
+    return;
+
+  auto &frame = emulator.frame();
+
+  screen.set_data(frame.screen);
+
+  if (frame.debug_generation == debug_generation)
+    return;
+
+  pattern_table_left.set_data(frame.pattern_tables[0]);
+  pattern_table_right.set_data(frame.pattern_tables[1]);
+  rendered_palette.set_data(frame.palettes);
+  debug_generation = frame.debug_generation;
+}
+
 void GUI::render() noexcept {
+  upload_frame();
+
   render_system_metrics();
   render_cpu_state();
   render_screen();
@@ -3,7 +3,7 @@
 
 #include <chrono>
 
-#include "bus.h"
+#include "emulator.h"
 #include "image.h"
 
 namespace nes::gui {
@@ -16,25 +16,30 @@ class GUI {
   const static auto display_resolution_multiplier = 2;
   int screen_size_multiplier = 2;
 
-  bus::Bus &bus;
+  // Everything the GUI shows comes out of the frames the emulator publishes.
+  emulator::Emulator &emulator;
 
   image::Image screen;
   image::Image pattern_table_left;
   image::Image pattern_table_right;
   image::Image rendered_palette;
+  // Generation of the debug views in the textures.
+  uint64_t debug_generation = ~0ull;
 
   uint64_t elapsed_clocks_second = 0;
-  uint64_t clocks_second_snapshot = 0;
+  uint64_t frames_second_snapshot = 0;
   time_point last_clock_capture = high_resolution_clock::now();
 
+  // Upload the newest frame's pixels, if there is a new one.
+  void upload_frame() noexcept;
   void render_cpu_state() noexcept;
   void render_ppu_state() noexcept;
   void render_system_metrics() noexcept;
-  void render_screen() const noexcept;
+  void render_screen() noexcept;
   void render_controller_input() const noexcept;
 
 public:
-  GUI(bus::Bus &bus) noexcept;
+  explicit GUI(emulator::Emulator &emulator) noexcept;
   ~GUI() noexcept;
 
   void render() noexcept;
@@ -1,8 +1,18 @@
+// Buffer objects aren't in the 1.x headers.
+#define GL_GLEXT_PROTOTYPES
+
+#include <cstring>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
 #include "image.h"
 #include "glext.h"
 
 namespace nes::image {
-Image::Image() noexcept {
+auto logger = spdlog::stderr_color_mt("nes::image");
+
+Image::Image(int width, int height) noexcept : width(width), height(height) {
   // Create a new texture.
   glGenTextures(1, &texture);
   // Bind that texture.
@@ -13,14 +23,57 @@ Image::Image() noexcept {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // Allocate the storage, once. glTexStorage2D would make it immutable, but
+  // that needs 4.2 and we only ask for 3.0 (3.2 on Mac).
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+               GL_UNSIGNED_INT_8_8_8_8, nullptr);
+
+  glGenBuffers(1, &pixel_buffer);
 }
 
-void Image::set_data(const GLuint *data, int width, int height) const noexcept {
-  // Bind the texture.
-  glBindTexture(GL_TEXTURE_2D, texture);
-  // Blit the image to the texture.
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-               GL_UNSIGNED_INT_8_8_8_8, data);
+Image::~Image() noexcept {
+  glDeleteBuffers(1, &pixel_buffer);
+  glDeleteTextures(1, &texture);
+}
+
+void Image::set_data(std::span<const uint32_t> data) noexcept {
+  if (data.size() != (size_t)width * height) {
+    logger->error("Expected {}x{} pixels, got {}", width, height, data.size());
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto size = (GLsizeiptr)data.size_bytes();
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+
+  // Orphan whatever the GPU might still be reading, and get fresh memory.
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  auto mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                 GL_MAP_WRITE_BIT |
+                                     GL_MAP_INVALIDATE_BUFFER_BIT);
+
+  if (mapped != nullptr) {
+    std::memcpy(mapped, data.data(), size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // The pixels come from the bound buffer, at offset 0.
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+                    GL_UNSIGNED_INT_8_8_8_8, nullptr);
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  if (mapped == nullptr) {
+    // Straight from our memory then.
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+                    GL_UNSIGNED_INT_8_8_8_8, data.data());
+  }
+
+  upload_time = std::chrono::steady_clock::now() - start;
 }
 
 ImTextureID Image::imgui_image() const noexcept {
@@ -1,24 +1,35 @@
 #ifndef NES_IMAGE_H
 #define NES_IMAGE_H
 
-#include <array>
+#include <chrono>
+#include <cstdint>
+#include <span>
 
 #include <GLFW/glfw3.h>
 #include <imgui_impl_opengl3.h>
 
 namespace nes::image {
+// A texture that gets new pixels most frames. Its storage is allocated once,
+// and pixels go through a pixel buffer, which is orphaned on every upload so
+// we never wait for the GPU to be done with the last one.
 class Image {
-  GLuint texture = -1;
+  GLuint texture = 0;
+  GLuint pixel_buffer = 0;
+  int width;
+  int height;
 
 public:
-  Image() noexcept;
-
-  void set_data(const GLuint *data, int width, int height) const noexcept;
-  template <size_t size>
-  void set_data(std::array<uint32_t, size> data, int width,
-                int height) const noexcept {
-    set_data((GLuint *)data.data(), width, height);
-  }
+  // How long the last upload took on our end, the GPU copies on its own time.
+  std::chrono::nanoseconds upload_time{};
+
+  Image(int width, int height) noexcept;
+  ~Image() noexcept;
+
+  Image(const Image &) = delete;
+  Image &operator=(const Image &) = delete;
+
+  // Upload a whole image of RGBA pixels.
+  void set_data(std::span<const uint32_t> data) noexcept;
 
   [[nodiscard]] ImTextureID imgui_image() const noexcept;
 };
@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "input.h"
+
+namespace nes::input {
+auto logger = spdlog::stderr_color_mt("nes::input");
+
+InputScript::InputScript(
+    std::vector<std::pair<uint64_t, uint8_t>> changes) noexcept
+    : changes(std::move(changes)) {
+  std::stable_sort(this->changes.begin(), this->changes.end(),
+                   [](auto &a, auto &b) { return a.first < b.first; });
+}
+
+uint8_t InputScript::state(uint64_t frame) const noexcept {
+  // Last change at or before the frame.
+  auto it = std::upper_bound(
+      changes.begin(), changes.end(), frame,
+      [](uint64_t frame, auto &change) { return frame < change.first; });
+
+  if (it == changes.begin())
+    return 0;
+
+  return std::prev(it)->second;
+}
+
+std::optional<InputScript> load(const std::string &file_path) noexcept {
+  std::ifstream file(file_path);
+  if (!file) {
+    logger->error("Unable to open the input file {}", file_path);
+    return std::nullopt;
+  }
+
+  std::vector<std::pair<uint64_t, uint8_t>> changes;
+  std::string line;
+
+  for (size_t line_number = 1; std::getline(file, line); line_number++) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream stream(line);
+    uint64_t frame = 0;
+    unsigned int state = 0;
+
+    if (!(stream >> frame >> std::hex >> state) || state > 0xff) {
+      logger->error("Invalid input on line {} of {}", line_number, file_path);
+      return std::nullopt;
+    }
+
+    changes.emplace_back(frame, state);
+  }
+
+  logger->debug("Loaded {} input changes from {}", changes.size(), file_path);
+  return InputScript(std::move(changes));
+}
+} // namespace nes::input
@@ -0,0 +1,36 @@
+#ifndef NES_INPUT_H
+#define NES_INPUT_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace nes::input {
+// Controller input recorded ahead of time, for running without anyone at the
+// keyboard.
+//
+// Input files are plain text, one change per line,
+//
+//   <frame> <controller 1 state, as a hex byte>
+//
+// The state is the same bit layout as `StandardController::state` (A is bit 7,
+// right is bit 0), and stays held until the next line changes it. Empty lines
+// and lines starting with # are ignored.
+class InputScript {
+  // (frame, state) pairs, sorted by frame.
+  std::vector<std::pair<uint64_t, uint8_t>> changes;
+
+public:
+  InputScript() noexcept = default;
+  explicit InputScript(
+      std::vector<std::pair<uint64_t, uint8_t>> changes) noexcept;
+
+  // Controller 1 state for the given frame.
+  [[nodiscard]] uint8_t state(uint64_t frame) const noexcept;
+};
+
+std::optional<InputScript> load(const std::string &file_path) noexcept;
+} // namespace nes::input
+
+#endif // NES_INPUT_H
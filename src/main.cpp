@@ -1,4 +1,4 @@
-#include <chrono>
+#include <memory>
 
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
@@ -10,9 +10,9 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
-#include "bus.h"
 #include "cart.h"
 #include "controller.h"
+#include "emulator.h"
 #include "gui.h"
 #include "platform.h"
 
@@ -114,18 +114,11 @@ int main([[maybe_unused]] const int argc, [[maybe_unused]] const char **argv) {
   ImGui_ImplGlfw_InitForOpenGL(window, true);
   ImGui_ImplOpenGL3_Init(glsl_version);
 
-  auto bus = bus::Bus(*loaded_cart);
-  gui::GUI gui(bus);
+  emulator::Emulator emulator(*loaded_cart);
+  auto gui = std::make_unique<gui::GUI>(emulator);
 
   auto clear_color = ImVec4(0.024f, 0.024f, 0.03f, 1.00f);
 
-  using std::chrono::high_resolution_clock;
-  using namespace std::literals;
-
-  // Get the remaining time until the next burst of ticks.
-  int64_t bus_residual_time_us = 0;
-  auto old_frame_start = high_resolution_clock::now();
-
   const static auto keys = {
       std::pair(GLFW_KEY_W, controller::Button::Up),
       std::pair(GLFW_KEY_A, controller::Button::Left),
@@ -137,44 +130,32 @@ int main([[maybe_unused]] const int argc, [[maybe_unused]] const char **argv) {
       std::pair(GLFW_KEY_L, controller::Button::A),
   };
 
+  // The emulator keeps its own time, this thread only draws whatever it
+  // publishes.
+  emulator.start();
+
   while (!glfwWindowShouldClose(window)) {
     glfwPollEvents();
 
-    auto frame_start = high_resolution_clock::now();
-    auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
-                          frame_start - old_frame_start)
-                          .count();
-    old_frame_start = frame_start;
-
     // Poll input.
+    controller::StandardController controller{};
     for (auto &key : keys) {
-      bus.controller_1.set_key(key.second, glfwGetKey(window, key.first) > 0);
+      controller.set_key(key.second, glfwGetKey(window, key.first) > 0);
     }
 
-    if (bus_residual_time_us > 0) {
-      bus_residual_time_us -= elapsed_us;
-      spdlog::trace("Residual time: {}, elapsed_us = {}", bus_residual_time_us,
-                    elapsed_us);
-    } else {
-      bus_residual_time_us += (1000000 / 60) - elapsed_us;
-
-      // Drain the bus.
-      while (!bus.ppu.frame_complete)
-        bus.tick();
-      // Prepare for the next frame.
-      bus.ppu.frame_complete = false;
-    }
-
-    bus.ppu.frame_complete = false;
-    spdlog::debug("Elapsed {}, FC = {}", bus.elapsed_cycles,
-                  bus.ppu.frame_complete);
+    // Holding R rewinds, holding Tab fast forwards.
+    emulator.set_input(emulator::Input{
+        .controller_1 = controller.state,
+        .rewind = glfwGetKey(window, GLFW_KEY_R) > 0,
+        .turbo = glfwGetKey(window, GLFW_KEY_TAB) > 0,
+    });
 
     // Initialize a new frame.
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
 
     ImGui::NewFrame();
-    gui.render();
+    gui->render();
 
     ImGui::Render();
 
@@ -190,6 +171,10 @@ int main([[maybe_unused]] const int argc, [[maybe_unused]] const char **argv) {
   }
 
   // Cleanup
+  emulator.stop();
+  // The GUI's textures go with it, while there still is a GL context.
+  gui.reset();
+
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
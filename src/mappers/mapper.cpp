@@ -1,3 +1,118 @@
 #include "mapper.h"
 
-namespace nes::cart::mappers {}
+namespace nes::cart::mappers {
+void Mapper::attach(std::span<const uint8_t> prg_rom,
+                    std::span<const uint8_t> prg_ram,
+                    std::span<const uint8_t> chr, bool chr_is_ram) noexcept {
+  this->prg_rom = prg_rom;
+  this->prg_ram = prg_ram;
+  this->chr = chr;
+  chr_writable = chr_is_ram;
+
+  reset();
+}
+
+void Mapper::write(uint16_t, uint8_t) noexcept {}
+
+void Mapper::a12_rise() noexcept {}
+
+void Mapper::save_registers(std::span<uint8_t, 32>) const noexcept {}
+
+void Mapper::load_registers(std::span<const uint8_t, 32>) noexcept {}
+
+// Offset of a window into the memory it points at.
+static int32_t window_offset(const uint8_t *window,
+                             std::span<const uint8_t> memory) noexcept {
+  return window == nullptr ? -1 : (int32_t)(window - memory.data());
+}
+
+static const uint8_t *window_pointer(int32_t offset,
+                                     std::span<const uint8_t> memory) noexcept {
+  return offset < 0 ? nullptr : memory.data() + offset;
+}
+
+// Whether a saved window lies within the memory it points at, or is unmapped.
+static bool window_valid(int32_t offset, size_t window_size,
+                         std::span<const uint8_t> memory) noexcept {
+  return offset == -1 ||
+         (offset >= 0 && (size_t)offset + window_size <= memory.size());
+}
+
+void Mapper::save(MapperState &state) const noexcept {
+  for (size_t i = 0; i < prg_windows.size(); i++)
+    state.prg_windows[i] =
+        window_offset(prg_windows[i], i == 0 ? prg_ram : prg_rom);
+  for (size_t i = 0; i < chr_windows.size(); i++)
+    state.chr_windows[i] = window_offset(chr_windows[i], chr);
+
+  state.prg_writable = prg_writable;
+  state.chr_writable = chr_writable;
+  state.mirroring = mirroring;
+  state.irq = irq;
+  state.irq_enabled = irq_enabled;
+
+  state.registers.fill(0);
+  save_registers(state.registers);
+}
+
+bool Mapper::load(const MapperState &state) noexcept {
+  for (size_t i = 0; i < prg_windows.size(); i++)
+    if (!window_valid(state.prg_windows[i], prg_window_size,
+                      i == 0 ? prg_ram : prg_rom))
+      return false;
+  for (size_t i = 0; i < chr_windows.size(); i++)
+    if (!window_valid(state.chr_windows[i], chr_window_size, chr))
+      return false;
+
+  for (size_t i = 0; i < prg_windows.size(); i++)
+    prg_windows[i] =
+        window_pointer(state.prg_windows[i], i == 0 ? prg_ram : prg_rom);
+  for (size_t i = 0; i < chr_windows.size(); i++)
+    chr_windows[i] = window_pointer(state.chr_windows[i], chr);
+
+  prg_writable = state.prg_writable;
+  chr_writable = state.chr_writable;
+  mirroring = state.mirroring;
+  irq = state.irq;
+  irq_enabled = state.irq_enabled;
+
+  load_registers(state.registers);
+  bank_generation++;
+  return true;
+}
+
+size_t Mapper::prg_banks() const noexcept {
+  return prg_rom.size() / prg_window_size;
+}
+
+size_t Mapper::chr_banks() const noexcept {
+  return chr.size() / chr_window_size;
+}
+
+void Mapper::map_prg_rom(size_t window, size_t bank, size_t count) noexcept {
+  for (size_t i = 0; i < count; i++) {
+    auto offset = ((bank + i) % prg_banks()) * prg_window_size;
+
+    prg_windows[window + i] = &prg_rom[offset];
+    prg_writable[window + i] = false;
+  }
+
+  bank_generation++;
+}
+
+void Mapper::map_prg_ram(bool enabled, bool writable) noexcept {
+  prg_windows[0] = enabled && !prg_ram.empty() ? prg_ram.data() : nullptr;
+  prg_writable[0] = prg_windows[0] != nullptr && writable;
+
+  bank_generation++;
+}
+
+void Mapper::map_chr(size_t window, size_t bank, size_t count) noexcept {
+  for (size_t i = 0; i < count; i++) {
+    auto offset = ((bank + i) % chr_banks()) * chr_window_size;
+    chr_windows[window + i] = &chr[offset];
+  }
+
+  bank_generation++;
+}
+} // namespace nes::cart::mappers
@@ -1,17 +1,118 @@
 #ifndef NES_MAPPER_H
 #define NES_MAPPER_H
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <span>
+
+namespace nes::cart {
+enum class MirroringMode {
+  Horizontal,
+  Vertical,
+  OneScreenLo,
+  OneScreenHi,
+};
+} // namespace nes::cart
 
 namespace nes::cart::mappers {
+// Snapshot of a mapper. Windows are stored as offsets into the memory they
+// point at, -1 when unmapped, so the state can be loaded into a mapper that
+// sits on another copy of the same cart.
+struct MapperState {
+  // Window 0 points into PRG RAM, the others into PRG ROM.
+  std::array<int32_t, 5> prg_windows;
+  std::array<bool, 5> prg_writable;
+  std::array<int32_t, 8> chr_windows;
+  bool chr_writable;
+
+  MirroringMode mirroring;
+  bool irq;
+  bool irq_enabled;
+
+  // Whatever registers the mapper has, laid out as it sees fit.
+  std::array<uint8_t, 32> registers;
+};
+
+// Mappers don't answer individual accesses. Instead, they publish which part of
+// the cart's memory is visible through each window of the CPU and PPU address
+// spaces, and only get called when the CPU writes to their registers. Reads
+// are a plain pointer lookup, without any virtual calls.
 class Mapper {
 public:
+  const static auto prg_window_size = 1 << 13;
+  const static auto chr_window_size = 1 << 10;
+
+  // 8kB PRG windows for $6000 (PRG RAM), $8000, $a000, $c000 and $e000.
+  std::array<const uint8_t *, 5> prg_windows{};
+  // Which PRG windows can be written to.
+  std::array<bool, 5> prg_writable{};
+  // 1kB CHR windows for $0000 -> $1fff.
+  std::array<const uint8_t *, 8> chr_windows{};
+  // Whether the CHR windows can be written to (CHR RAM).
+  bool chr_writable = false;
+
+  // Nametable mirroring. Starts off as whatever the header says, mappers that
+  // control it switch it at runtime.
+  MirroringMode mirroring = MirroringMode::Horizontal;
+
+  // Mappers with a scanline counter clocked by rises of the PPU's A12 (MMC3).
+  // The PPU only bothers tracking A12 when this is set.
+  bool watches_a12 = false;
+  // IRQ line, held until the CPU acknowledges it through the mapper.
+  bool irq = false;
+  // Whether the mapper may raise an IRQ at all. While it can't, nobody has to
+  // poll the IRQ line.
+  bool irq_enabled = false;
+
+  // Bumped every time the mapper switches banks, so whoever caches pointers
+  // into the cart knows when to refresh them.
+  uint32_t bank_generation = 0;
+
   virtual ~Mapper() = default;
 
-  virtual bool should_bus_read(uint16_t addr, uint16_t &mapped) = 0;
-  virtual bool should_bus_write(uint16_t addr, uint16_t &mapped) = 0;
-  virtual bool should_ppu_read(uint16_t addr, uint16_t &mapped) = 0;
-  virtual bool should_ppu_write(uint16_t addr, uint16_t &mapped) = 0;
+  // Hook the mapper up to the cart's memory, and map the power-on banks. The
+  // mapper only ever hands out pointers, writes are up to the cart.
+  void attach(std::span<const uint8_t> prg_rom,
+              std::span<const uint8_t> prg_ram, std::span<const uint8_t> chr,
+              bool chr_is_ram) noexcept;
+
+  // CPU write to the mapper's registers ($8000 -> $ffff).
+  virtual void write(uint16_t address, uint8_t value) noexcept;
+  // The PPU's A12 went high after being low for a while.
+  virtual void a12_rise() noexcept;
+
+  void save(MapperState &state) const noexcept;
+  // Fails, leaving the mapper alone, if a window points outside the memory
+  // behind it.
+  bool load(const MapperState &state) noexcept;
+
+protected:
+  std::span<const uint8_t> prg_rom;
+  std::span<const uint8_t> prg_ram;
+  std::span<const uint8_t> chr;
+
+  // Map the power-on banks.
+  virtual void reset() noexcept = 0;
+  // Save and load the mapper's own registers. Windows and flags are taken
+  // care of already.
+  virtual void save_registers(std::span<uint8_t, 32> registers) const noexcept;
+  virtual void load_registers(std::span<const uint8_t, 32> registers) noexcept;
+
+  // Number of 8kB PRG ROM banks.
+  [[nodiscard]] size_t prg_banks() const noexcept;
+  // Number of 1kB CHR banks.
+  [[nodiscard]] size_t chr_banks() const noexcept;
+
+  // Map `count` consecutive 8kB PRG ROM banks, starting at `bank`, to the PRG
+  // windows starting at `window` ($8000 is window 1). Banks wrap around the
+  // size of the ROM.
+  void map_prg_rom(size_t window, size_t bank, size_t count = 1) noexcept;
+  // Map the PRG RAM to $6000, or unmap it.
+  void map_prg_ram(bool enabled, bool writable) noexcept;
+  // Map `count` consecutive 1kB CHR banks, starting at `bank`, to the CHR
+  // windows starting at `window`. Banks wrap around the size of the CHR.
+  void map_chr(size_t window, size_t bank, size_t count = 1) noexcept;
 };
 } // namespace nes::cart::mappers
 
@@ -8,48 +8,20 @@ namespace mmc0 {
 auto logger = spdlog::stderr_color_mt("nes::cart::mappers::mmc0");
 }
 
-MMC0::MMC0(uint8_t num_prg_chunks, uint8_t num_chr_chunks) noexcept
-    : is_32k(num_prg_chunks > 1), is_chr_writable(num_chr_chunks == 0) {
+MMC0::MMC0(uint8_t num_prg_chunks, uint8_t num_chr_chunks) noexcept {
   mmc0::logger->info(
       "PRG Chunks: {}, CHR Chunks: {}, is 32k: {}, CHR writable: {}",
-      num_prg_chunks, num_chr_chunks, is_32k, is_chr_writable);
+      num_prg_chunks, num_chr_chunks, num_prg_chunks > 1, num_chr_chunks == 0);
 }
 
-bool MMC0::should_bus_read(uint16_t addr, uint16_t &mapped) {
+void MMC0::reset() noexcept {
   // For 32k, 0x8000 -> 0xffff = prg[0x0000 -> 0x7fff].
-  // For 16k, 0x8000 -> 0xffff = prg[0x0000 -> 0x3fff] (mirrored twice).
+  // For 16k, 0x8000 -> 0xffff = prg[0x0000 -> 0x3fff] (mirrored twice), which
+  // the banks wrapping around the ROM size takes care of.
+  map_prg_rom(1, 0, 4);
 
-  if (addr < 0x8000)
-    return false;
-
-  mapped = addr & (is_32k ? 0x7fff : 0x3fff);
-  return true;
-}
-
-bool MMC0::should_bus_write(uint16_t addr, uint16_t &mapped) {
-  if (addr < 0x8000)
-    return false;
-
-  mapped = addr & (is_32k ? 0x7fff : 0x3fff);
-  return true;
-}
-
-bool MMC0::should_ppu_read(uint16_t addr, uint16_t &mapped) {
-  // 0x0000 -> 0x1fff -> chr[0x0000 -> 0x1fff];
-  if (addr > 0x1fff)
-    return false;
-
-  mapped = addr;
-  return true;
-}
-
-bool MMC0::should_ppu_write(uint16_t addr, uint16_t &mapped) {
-  // If num_chr_chunks is zero, we treat this as RAM.
-  if (addr > 0x1fff || !is_chr_writable)
-    return false;
-
-  mapped = addr;
-  return true;
+  // 0x0000 -> 0x1fff -> chr[0x0000 -> 0x1fff].
+  map_chr(0, 0, 8);
 }
 
 MMC0::~MMC0() noexcept {
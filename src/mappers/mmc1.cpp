@@ -0,0 +1,116 @@
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "mmc1.h"
+
+namespace nes::cart::mappers {
+namespace mmc1 {
+auto logger = spdlog::stderr_color_mt("nes::cart::mappers::mmc1");
+}
+
+MMC1::MMC1(uint8_t num_prg_chunks, uint8_t num_chr_chunks) noexcept {
+  mmc1::logger->info("PRG Chunks: {}, CHR Chunks: {}", num_prg_chunks,
+                     num_chr_chunks);
+}
+
+void MMC1::reset() noexcept {
+  shift = 0x10;
+  control = 0x0c;
+  chr_bank_0 = 0;
+  chr_bank_1 = 0;
+  prg_bank = 0;
+
+  remap();
+}
+
+void MMC1::save_registers(std::span<uint8_t, 32> registers) const noexcept {
+  registers[0] = shift;
+  registers[1] = control;
+  registers[2] = chr_bank_0;
+  registers[3] = chr_bank_1;
+  registers[4] = prg_bank;
+}
+
+void MMC1::load_registers(std::span<const uint8_t, 32> registers) noexcept {
+  shift = registers[0];
+  control = registers[1];
+  chr_bank_0 = registers[2];
+  chr_bank_1 = registers[3];
+  prg_bank = registers[4];
+}
+
+void MMC1::write(uint16_t address, uint8_t value) noexcept {
+  // Writing a value with bit 7 set resets the shift register, and locks the
+  // last bank at $c000.
+  if (value & 0x80) {
+    shift = 0x10;
+    control |= 0x0c;
+    remap();
+    return;
+  }
+
+  auto complete = shift & 0x1;
+  shift = (shift >> 1) | ((value & 0x1) << 4);
+  if (!complete)
+    return;
+
+  // Bits 13 and 14 of the address of the fifth write pick the register.
+  switch ((address >> 13) & 0x3) {
+  case 0: control = shift; break;
+  case 1: chr_bank_0 = shift; break;
+  case 2: chr_bank_1 = shift; break;
+  case 3: prg_bank = shift; break;
+  default: break;
+  }
+
+  mmc1::logger->debug("Control: {:#04x}, CHR: {:#04x} {:#04x}, PRG: {:#04x}",
+                      control, chr_bank_0, chr_bank_1, prg_bank);
+
+  shift = 0x10;
+  remap();
+}
+
+void MMC1::remap() noexcept {
+  switch (control & 0x3) {
+  case 0: mirroring = MirroringMode::OneScreenLo; break;
+  case 1: mirroring = MirroringMode::OneScreenHi; break;
+  case 2: mirroring = MirroringMode::Vertical; break;
+  case 3: mirroring = MirroringMode::Horizontal; break;
+  default: break;
+  }
+
+  // 512kB carts (SUROM) use bit 4 of the CHR bank to pick which 256kB half of
+  // PRG ROM is visible. Banks here are 16kB.
+  size_t outer = prg_banks() > 32 ? chr_bank_0 & 0x10 : 0;
+  size_t bank = outer | (prg_bank & 0x0f);
+  size_t last = outer | 0x0f;
+
+  switch ((control >> 2) & 0x3) {
+  case 0:
+  case 1: map_prg_rom(1, (bank & ~0x1) * 2, 4); break;
+  case 2:
+    map_prg_rom(1, outer * 2, 2);
+    map_prg_rom(3, bank * 2, 2);
+    break;
+  case 3:
+    map_prg_rom(1, bank * 2, 2);
+    map_prg_rom(3, last * 2, 2);
+    break;
+  default: break;
+  }
+
+  // Bit 4 of the PRG bank disables PRG RAM.
+  map_prg_ram((prg_bank & 0x10) == 0, true);
+
+  if (control & 0x10) {
+    map_chr(0, chr_bank_0 * 4, 4);
+    map_chr(4, chr_bank_1 * 4, 4);
+  } else {
+    map_chr(0, (chr_bank_0 & ~0x1) * 4, 8);
+  }
+}
+
+MMC1::~MMC1() noexcept {
+  mmc1::logger->info("Destructed the mapper");
+}
+} // namespace nes::cart::mappers
@@ -0,0 +1,48 @@
+#ifndef NES_MMC1_H
+#define NES_MMC1_H
+
+#include "mapper.h"
+
+namespace nes::cart::mappers {
+// https://www.nesdev.org/wiki/MMC1
+class MMC1 : public Mapper {
+  // Writes are shifted in one bit at a time, LSB first. The 1 marks the end,
+  // once it reaches bit 0 the fifth write commits the register.
+  uint8_t shift = 0x10;
+
+  // 4bit0
+  // -----
+  // CPPMM
+  // |||||
+  // |||++- Mirroring (0: one-screen, lower bank; 1: one-screen, upper bank;
+  // |||               2: vertical; 3: horizontal)
+  // |++--- PRG ROM bank mode (0, 1: switch 32 KB at $8000, ignoring low bit
+  // |                         of bank number;
+  // |                         2: fix first bank at $8000 and switch 16 KB bank
+  // |                         at $C000;
+  // |                         3: fix last bank at $C000 and switch 16 KB bank
+  // |                         at $8000)
+  // +----- CHR ROM bank mode (0: switch 8 KB at a time; 1: switch two
+  //                           separate 4 KB banks)
+  uint8_t control = 0x0c;
+  uint8_t chr_bank_0 = 0;
+  uint8_t chr_bank_1 = 0;
+  uint8_t prg_bank = 0;
+
+  // Point the windows at the banks the registers select.
+  void remap() noexcept;
+
+protected:
+  void reset() noexcept override;
+  void save_registers(std::span<uint8_t, 32> registers) const noexcept override;
+  void load_registers(std::span<const uint8_t, 32> registers) noexcept override;
+
+public:
+  MMC1(uint8_t num_prg_chunks, uint8_t num_chr_chunks) noexcept;
+  ~MMC1() noexcept override;
+
+  void write(uint16_t address, uint8_t value) noexcept override;
+};
+} // namespace nes::cart::mappers
+
+#endif // NES_MMC1_H
@@ -0,0 +1,150 @@
+#include <algorithm>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "mmc3.h"
+
+namespace nes::cart::mappers {
+namespace mmc3 {
+auto logger = spdlog::stderr_color_mt("nes::cart::mappers::mmc3");
+}
+
+MMC3::MMC3(uint8_t num_prg_chunks, uint8_t num_chr_chunks) noexcept {
+  mmc3::logger->info("PRG Chunks: {}, CHR Chunks: {}", num_prg_chunks,
+                     num_chr_chunks);
+
+  watches_a12 = true;
+}
+
+void MMC3::reset() noexcept {
+  bank_select = 0;
+  banks = {0, 2, 4, 5, 6, 7, 0, 1};
+
+  irq_latch = 0;
+  irq_counter = 0;
+  irq_reload = false;
+  irq_enabled = false;
+  irq = false;
+
+  map_prg_ram(true, true);
+  remap();
+}
+
+void MMC3::save_registers(std::span<uint8_t, 32> registers) const noexcept {
+  registers[0] = bank_select;
+  std::copy(banks.begin(), banks.end(), &registers[1]);
+  registers[9] = irq_latch;
+  registers[10] = irq_counter;
+  registers[11] = irq_reload;
+}
+
+void MMC3::load_registers(std::span<const uint8_t, 32> registers) noexcept {
+  bank_select = registers[0];
+  std::copy_n(&registers[1], banks.size(), banks.begin());
+  irq_latch = registers[9];
+  irq_counter = registers[10];
+  irq_reload = registers[11];
+}
+
+void MMC3::write(uint16_t address, uint8_t value) noexcept {
+  // Every register is mirrored all over its 8kB, even and odd addresses pick
+  // between the pair.
+  auto odd = address & 0x1;
+
+  switch (address & 0xe000) {
+  case 0x8000: {
+    // Every remap throws away the bus' pages and the block being run, and
+    // games write these pairs several times a frame. Only remap when a window
+    // moves, not when picking the next register to write.
+    auto moved = false;
+    if (odd) {
+      auto &bank = banks[bank_select & 0x07];
+      moved = bank != value;
+      bank = value;
+    } else {
+      moved = ((bank_select ^ value) & 0xc0) != 0;
+      bank_select = value;
+    }
+
+    if (moved)
+      remap();
+    break;
+  }
+
+  case 0xa000:
+    if (odd) {
+      // Bit 7 enables PRG RAM, bit 6 write protects it.
+      map_prg_ram(value & 0x80, (value & 0x40) == 0);
+    } else {
+      mirroring = value & 0x1 ? MirroringMode::Horizontal
+                              : MirroringMode::Vertical;
+    }
+    break;
+
+  case 0xc000:
+    if (odd) {
+      // The counter reloads on the next rise.
+      irq_counter = 0;
+      irq_reload = true;
+    } else {
+      irq_latch = value;
+    }
+    break;
+
+  case 0xe000:
+    if (odd) {
+      irq_enabled = true;
+    } else {
+      // Disabling also acknowledges a pending IRQ.
+      irq_enabled = false;
+      irq = false;
+    }
+    break;
+
+  default: break;
+  }
+}
+
+void MMC3::a12_rise() noexcept {
+  if (irq_counter == 0 || irq_reload) {
+    irq_counter = irq_latch;
+    irq_reload = false;
+  } else {
+    irq_counter--;
+  }
+
+  if (irq_counter == 0 && irq_enabled)
+    irq = true;
+}
+
+void MMC3::remap() noexcept {
+  auto second_last = prg_banks() - 2;
+
+  if (bank_select & 0x40) {
+    map_prg_rom(1, second_last);
+    map_prg_rom(3, banks[6] & 0x3f);
+  } else {
+    map_prg_rom(1, banks[6] & 0x3f);
+    map_prg_rom(3, second_last);
+  }
+
+  map_prg_rom(2, banks[7] & 0x3f);
+  map_prg_rom(4, second_last + 1);
+
+  // With A12 inversion, the 2kB banks go to $1000 and the 1kB ones to $0000.
+  size_t lo = bank_select & 0x80 ? 4 : 0;
+  size_t hi = lo ^ 4;
+
+  map_chr(lo, banks[0] & 0xfe, 2);
+  map_chr(lo + 2, banks[1] & 0xfe, 2);
+  map_chr(hi, banks[2]);
+  map_chr(hi + 1, banks[3]);
+  map_chr(hi + 2, banks[4]);
+  map_chr(hi + 3, banks[5]);
+}
+
+MMC3::~MMC3() noexcept {
+  mmc3::logger->info("Destructed the mapper");
+}
+} // namespace nes::cart::mappers
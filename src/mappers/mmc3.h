@@ -0,0 +1,44 @@
+#ifndef NES_MMC3_H
+#define NES_MMC3_H
+
+#include "mapper.h"
+
+namespace nes::cart::mappers {
+// https://www.nesdev.org/wiki/MMC3
+class MMC3 : public Mapper {
+  // 7  bit  0
+  // ---- ----
+  // CPMx xRRR
+  // |||   |||
+  // |||   +++- Which bank register to update on the next bank data write
+  // ||+------- Nothing on the MMC3
+  // |+-------- PRG ROM bank mode (0: $8000 swappable, $c000 fixed to the
+  // |          second-last bank; 1: the other way around)
+  // +--------- CHR A12 inversion (0: two 2kB banks at $0000, four 1kB banks
+  //            at $1000; 1: the other way around)
+  uint8_t bank_select = 0;
+  // R0 -> R7.
+  std::array<uint8_t, 8> banks{};
+
+  uint8_t irq_latch = 0;
+  uint8_t irq_counter = 0;
+  bool irq_reload = false;
+
+  // Point the windows at the banks the registers select.
+  void remap() noexcept;
+
+protected:
+  void reset() noexcept override;
+  void save_registers(std::span<uint8_t, 32> registers) const noexcept override;
+  void load_registers(std::span<const uint8_t, 32> registers) noexcept override;
+
+public:
+  MMC3(uint8_t num_prg_chunks, uint8_t num_chr_chunks) noexcept;
+  ~MMC3() noexcept override;
+
+  void write(uint16_t address, uint8_t value) noexcept override;
+  void a12_rise() noexcept override;
+};
+} // namespace nes::cart::mappers
+
+#endif // NES_MMC3_H
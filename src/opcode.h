@@ -89,7 +89,7 @@ struct Opcode {
 };
 
 // Idea is to crash when we encounter an unknown opcode.
-const auto unknown_op = Opcode{
+constexpr auto unknown_op = Opcode{
     .operation = Op::NOP,
     .mode = AddressingMode::Implicit,
     .cycles = 2,
@@ -100,7 +100,39 @@ const auto unknown_op = Opcode{
 // An alias for brevity.
 using AM = AddressingMode;
 
-const Opcode opcodes[256] = {
+// Size of an instruction in bytes, opcode included.
+constexpr int length(AddressingMode mode) {
+  switch (mode) {
+  case AM::Implicit: return 1;
+  case AM::Absolute:
+  case AM::Indirect:
+  case AM::AbsoluteX:
+  case AM::AbsoluteY: return 3;
+  default: return 2;
+  }
+}
+
+// Whether the instruction may go anywhere but the next one.
+constexpr bool changes_flow(Op op) {
+  switch (op) {
+  case Op::BCC:
+  case Op::BCS:
+  case Op::BEQ:
+  case Op::BMI:
+  case Op::BNE:
+  case Op::BPL:
+  case Op::BRK:
+  case Op::BVC:
+  case Op::BVS:
+  case Op::JMP:
+  case Op::JSR:
+  case Op::RTI:
+  case Op::RTS: return true;
+  default: return false;
+  }
+}
+
+constexpr Opcode opcodes[256] = {
     {Op::BRK, AM::Implicit, 7},
     {Op::ORA, AM::IndirectX, 6},
     unknown_op,
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
@@ -6,87 +8,90 @@
 namespace nes::ppu {
 auto logger = spdlog::stderr_color_mt("nes::ppu");
 
-PPU::PPU(std::shared_ptr<cart::Cart> cart) noexcept : cart(std::move(cart)) {
+PPU::PPU(std::shared_ptr<cart::Cart> cart) noexcept
+    : Registers(), cart(std::move(cart)),
+      watch_a12(this->cart->watches_a12()) {
+  resolve_palettes();
   logger->trace("Constructed the PPU.");
 }
 
-void PPU::tick() noexcept {
-  logger->trace("Tick.");
+void PPU::increment_coarse_x() noexcept {
+  if (!mask.show_background && !mask.show_sprites) {
+    return;
+  }
 
-  // https://www.nesdev.org/wiki/PPU_scrolling is your friend.
-  // And bless C++ lambdas... for existing...
+  if (v.coarse_x == 31) {
+    // We overflowed. Time to reset.
+    v.coarse_x = 0;
+    // And switch nametables.
+    v.nametable_x = ~v.nametable_x;
+  } else {
+    v.coarse_x++;
+  }
+}
 
-  auto increment_coarse_x = [&]() {
-    if (!mask.show_background && !mask.show_sprites) {
-      return;
-    }
+void PPU::increment_y() noexcept {
+  if (!mask.show_background && !mask.show_sprites) {
+    return;
+  }
 
-    if (v.coarse_x == 31) {
-      // We overflowed. Time to reset.
-      v.coarse_x = 0;
-      // And switch nametables.
-      v.nametable_x = ~v.nametable_x;
+  if (v.fine_y < 7) {
+    // We can get-by by incrementing the fine y value.
+    v.fine_y++;
+  } else {
+    // Set fine_y to zero.
+    v.fine_y = 0;
+
+    if (v.coarse_y == 29) {
+      // Remember we have 30 tiles (30 * 8 = 240 dots) in the y direction.
+      v.coarse_y = 0;
+      // Switching the vertical nametable.
+      v.nametable_y = ~v.nametable_y;
+    } else if (v.coarse_y == 31) {
+      // How did the coarse_y overflow in the attribute memory?
+      v.coarse_y = 0;
     } else {
-      v.coarse_x++;
+      // Ugh increment.
+      v.coarse_y++;
     }
-  };
+  }
+}
 
-  auto increment_y = [&]() {
-    if (!mask.show_background && !mask.show_sprites) {
-      return;
-    }
+void PPU::transfer_x_addr() noexcept {
+  if (!mask.show_background && !mask.show_sprites) {
+    return;
+  }
 
-    if (v.fine_y < 7) {
-      // We can get-by by incrementing the fine y value.
-      v.fine_y++;
-    } else {
-      // Set fine_y to zero.
-      v.fine_y = 0;
-
-      if (v.coarse_y == 29) {
-        // Remember we have 30 tiles (30 * 8 = 240 dots) in the y direction.
-        v.coarse_y = 0;
-        // Switching the vertical nametable.
-        v.nametable_y = ~v.nametable_y;
-      } else if (v.coarse_y == 31) {
-        // How did the coarse_y overflow in the attribute memory?
-        v.coarse_y = 0;
-      } else {
-        // Ugh increment.
-        v.coarse_y++;
-      }
-    }
-  };
+  v.coarse_x = t.coarse_x;
+  v.nametable_x = t.nametable_x;
+}
 
-  auto transfer_x_addr = [&]() {
-    if (!mask.show_background && !mask.show_sprites) {
-      return;
-    }
+void PPU::transfer_y_addr() noexcept {
+  if (!mask.show_background && !mask.show_sprites) {
+    return;
+  }
 
-    v.coarse_x = t.coarse_x;
-    v.nametable_x = t.nametable_x;
-  };
+  v.fine_y = t.fine_y;
+  v.coarse_y = t.coarse_y;
+  v.nametable_y = t.nametable_y;
+}
 
-  auto transfer_y_addr = [&]() {
-    if (!mask.show_background && !mask.show_sprites) {
-      return;
-    }
+void PPU::load_sr_bg() noexcept {
+  sr_bg_pattern_lo = (sr_bg_pattern_lo & 0xff00) | bg_next_tile_lo;
+  sr_bg_pattern_hi = (sr_bg_pattern_hi & 0xff00) | bg_next_tile_hi;
 
-    v.fine_y = t.fine_y;
-    v.coarse_y = t.coarse_y;
-    v.nametable_y = t.nametable_y;
-  };
+  // Ummm inflation. We just saved some computation here.
+  sr_bg_attrib_lo =
+      (sr_bg_attrib_lo & 0xff00) | ((bg_next_attrib & 0b01) ? 0xff : 0x00);
+  sr_bg_attrib_hi =
+      (sr_bg_attrib_hi & 0xff00) | ((bg_next_attrib & 0b10) ? 0xff : 0x00);
+}
 
-  auto load_sr_bg = [&]() {
-    sr_bg_pattern_lo = (sr_bg_pattern_lo & 0xff00) | bg_next_tile_lo;
-    sr_bg_pattern_hi = (sr_bg_pattern_hi & 0xff00) | bg_next_tile_hi;
+void PPU::tick() noexcept {
+  logger->trace("Tick.");
 
-    // Ummm inflation. We just saved some computation here.
-    sr_bg_attrib_lo =
-        (sr_bg_attrib_lo & 0xff00) | ((bg_next_attrib & 0b01) ? 0xff : 0x00);
-    sr_bg_attrib_hi =
-        (sr_bg_attrib_hi & 0xff00) | ((bg_next_attrib & 0b10) ? 0xff : 0x00);
-  };
+  // https://www.nesdev.org/wiki/PPU_scrolling is your friend.
+  // And bless C++ lambdas... for existing...
 
   auto update_sr = [&]() {
     if (mask.show_background) {
@@ -105,8 +110,7 @@ void PPU::tick() noexcept {
         if (secondary_oam[i].x > 0)
           secondary_oam[i].x--;
         else {
-          sr_sprite_pattern_lo[i] <<= 1;
-          sr_sprite_pattern_hi[i] <<= 1;
+          sr_sprite_pattern[i] <<= 2;
         }
       }
     }
@@ -129,8 +133,7 @@ void PPU::tick() noexcept {
       status.sprite_overflow = 0;
       status.sprite_0_hit = 0;
 
-      sr_sprite_pattern_lo.fill(0);
-      sr_sprite_pattern_hi.fill(0);
+      sr_sprite_pattern.fill(0);
     }
 
     // Essentially skipping the HBLANK now.
@@ -229,8 +232,7 @@ void PPU::tick() noexcept {
     if (scanline >= 0 && cycle == 257) {
       // Clear the secondary OAM with 0xff.
       secondary_oam.fill({0xff, 0xff, 0xff, 0xff});
-      sr_sprite_pattern_lo.fill(0);
-      sr_sprite_pattern_hi.fill(0);
+      sr_sprite_pattern.fill(0);
       sprite_count = 0;
       sprite_0_hit_possible = false;
 
@@ -268,11 +270,13 @@ void PPU::tick() noexcept {
       status.sprite_overflow = sprite_count > 8;
     }
 
-    if (cycle == 340) {
-      for (auto i = 0; i < sprite_count; i++) {
-        if (i >= 8)
-          break;
+    // Fetch the sprite patterns for the next scanline, one sprite every 8
+    // dots. Empty slots still fetch tile 0xff, mappers watching A12 count on
+    // that.
+    if (cycle >= 261 && cycle < 320 && (cycle & 0x07) == 5) {
+      auto i = (cycle - 261) >> 3;
 
+      if (i < sprite_count) {
         auto sprite = secondary_oam[i];
         auto flipped = sprite.attribute & 0x80;
 
@@ -314,24 +318,14 @@ void PPU::tick() noexcept {
           }
         }
 
-        auto low_bitplane = ppu_read(addr_low);
-        auto high_bitplane = ppu_read(addr_low + 8);
-
         // Flipped horizontally.
-        if (sprite.attribute & 0x40) {
-          auto flip_byte = [](uint8_t b) -> uint8_t {
-            b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
-            b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
-            b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
-            return b;
-          };
-
-          low_bitplane = flip_byte(low_bitplane);
-          high_bitplane = flip_byte(high_bitplane);
-        }
-
-        sr_sprite_pattern_lo[i] = low_bitplane;
-        sr_sprite_pattern_hi[i] = high_bitplane;
+        sr_sprite_pattern[i] =
+            fetch_sprite_row(addr_low, sprite.attribute & 0x40);
+      } else if (watch_a12) {
+        // In 8x16 mode, tile 0xff comes from the second pattern table.
+        ppu_read(control.sprite_16x8_mode
+                     ? 0x1fe0
+                     : (control.sprite_pattern_table << 12) | 0x0ff0);
       }
     }
   }
@@ -377,9 +371,7 @@ void PPU::tick() noexcept {
       if (secondary_oam[i].x != 0)
         continue;
 
-      uint8_t pixel_lo = (sr_sprite_pattern_lo[i] & 0x80) > 0;
-      uint8_t pixel_hi = (sr_sprite_pattern_hi[i] & 0x80) > 0;
-      spr_pixel = (pixel_hi << 1) | pixel_lo;
+      spr_pixel = sr_sprite_pattern[i] >> 14;
 
       spr_palette = (secondary_oam[i].attribute & 0x03) + 0x04;
       spr_priority = (secondary_oam[i].attribute & 0x20) == 0;
@@ -393,28 +385,14 @@ void PPU::tick() noexcept {
     }
   }
 
-  uint8_t pixel = 0;
-  uint8_t palette = 0;
-
-  // Finally, get what pixel won.
-  if (bg_pixel != 0 && spr_pixel == 0) {
-    pixel = bg_pixel;
-    palette = bg_palette;
-  } else if (bg_pixel == 0 && spr_pixel != 0) {
-    pixel = spr_pixel;
-    palette = spr_palette;
-  } else if (bg_pixel != 0 && spr_pixel != 0) {
-    pixel = spr_priority ? spr_pixel : bg_pixel;
-    palette = spr_priority ? spr_palette : bg_palette;
-
-    if (sprite_0_hit_possible && sprite_0_hit_rendered && mask.show_sprites &&
-        mask.show_background) {
-      if (~(mask.left_sprite | mask.left_background) && cycle >= 9 &&
-          cycle < 258)
-        status.sprite_0_hit = 1;
-      else if (cycle >= 1 && cycle < 258)
-        status.sprite_0_hit = 1;
-    }
+  // Sprite 0 hits on any opaque pixel of both, whichever wins.
+  if (bg_pixel != 0 && spr_pixel != 0 && sprite_0_hit_possible &&
+      sprite_0_hit_rendered && mask.show_sprites && mask.show_background) {
+    if (~(mask.left_sprite | mask.left_background) && cycle >= 9 &&
+        cycle < 258)
+      status.sprite_0_hit = 1;
+    else if (cycle >= 1 && cycle < 258)
+      status.sprite_0_hit = 1;
   }
 
   // Time to draw.
@@ -422,9 +400,26 @@ void PPU::tick() noexcept {
   auto y = scanline;
 
   // Yes.
-  if (x >= 0 && x < 256 && y >= 0 && y < 240)
+  if (write_screen && x >= 0 && x < 256 && y >= 0 && y < 240) {
+    uint8_t pixel = 0;
+    uint8_t palette = 0;
+
+    // Finally, get what pixel won.
+    if (bg_pixel != 0 && spr_pixel == 0) {
+      pixel = bg_pixel;
+      palette = bg_palette;
+    } else if (bg_pixel == 0 && spr_pixel != 0) {
+      pixel = spr_pixel;
+      palette = spr_palette;
+    } else if (bg_pixel != 0 && spr_pixel != 0) {
+      pixel = spr_priority ? spr_pixel : bg_pixel;
+      palette = spr_priority ? spr_palette : bg_palette;
+    }
+
     screen[y * screen_width + x] = get_color(palette, pixel);
+  }
 
+  dot++;
   cycle++;
   if (cycle >= 341) {
     cycle = 0;
@@ -437,32 +432,337 @@ void PPU::tick() noexcept {
   }
 }
 
+void PPU::run(uint64_t dots) noexcept {
+  while (dots > 0) {
+    // Dot (0, 0) is skipped, so scanline 0 starts at cycle 0.
+    auto line_start = cycle == 1 || (scanline == 0 && cycle == 0);
+
+    if (scanline_renderer && dots >= 256 && line_start && scanline >= 0 &&
+        scanline < 240) {
+      render_line();
+      dots -= 256;
+      continue;
+    }
+
+    tick();
+    dots--;
+  }
+}
+
+void PPU::render_line() noexcept {
+  cycle = 1;
+  auto start = dot;
+
+  // Resolve the sprites first. Lowest index wins, just like the per dot path.
+  // Each entry is pixel | palette << 2 | priority << 5 | sprite 0 << 6, zero
+  // for transparent.
+  std::array<uint8_t, screen_width> sprite_line{};
+  auto sprites = std::min<uint8_t>(sprite_count, 8);
+
+  // Without a screen to draw on, pixels only matter for sprite 0 hits. Skip
+  // them unless one can still happen on this line.
+  auto pixels = write_screen ||
+                (sprite_0_hit_possible && mask.show_sprites &&
+                 mask.show_background && !status.sprite_0_hit);
+
+  if (pixels && mask.show_sprites) {
+    for (auto i = 0; i < sprites; i++) {
+      auto &sprite = secondary_oam[i];
+
+      for (auto d = 0; d < 8 && sprite.x + d < screen_width; d++) {
+        uint8_t pixel = (sr_sprite_pattern[i] >> (14 - d * 2)) & 0x3;
+
+        auto &entry = sprite_line[sprite.x + d];
+        if (pixel == 0 || entry != 0)
+          continue;
+
+        entry = pixel | (((sprite.attribute & 0x03) + 0x04) << 2) |
+                (((sprite.attribute & 0x20) == 0) << 5) | ((i == 0) << 6);
+      }
+    }
+  }
+
+  auto y = scanline;
+
+  for (auto tile = 0; tile < 32; tile++) {
+    // Cycle 1 of every tile but the first. The shift registers are loaded with
+    // the tile we fetched last, right after their 8th shift since the last
+    // load. Nothing happens on cycle 1 itself, the registers were loaded on
+    // cycle 337 already.
+    if (tile > 0) {
+      if (mask.show_background) {
+        sr_bg_pattern_lo <<= 1;
+        sr_bg_pattern_hi <<= 1;
+        sr_bg_attrib_lo <<= 1;
+        sr_bg_attrib_hi <<= 1;
+      }
+
+      load_sr_bg();
+    }
+
+    for (auto i = 0; i < 8 && pixels; i++) {
+      auto x = tile * 8 + i;
+
+      uint8_t bg_pixel = 0;
+      uint8_t bg_palette = 0;
+
+      if (mask.show_background) {
+        // The registers shift once per dot, so instead of shifting, look
+        // further down.
+        auto bit = 15 - fine_x - i;
+
+        bg_pixel = (((sr_bg_pattern_hi >> bit) & 0x1) << 1) |
+                   ((sr_bg_pattern_lo >> bit) & 0x1);
+        bg_palette = (((sr_bg_attrib_hi >> bit) & 0x1) << 1) |
+                     ((sr_bg_attrib_lo >> bit) & 0x1);
+      }
+
+      auto sprite = sprite_line[x];
+      uint8_t spr_pixel = sprite & 0x03;
+      uint8_t spr_palette = (sprite >> 2) & 0x07;
+      uint8_t spr_priority = (sprite >> 5) & 0x1;
+
+      uint8_t pixel = 0;
+      uint8_t palette = 0;
+
+      if (bg_pixel != 0 && spr_pixel == 0) {
+        pixel = bg_pixel;
+        palette = bg_palette;
+      } else if (bg_pixel == 0 && spr_pixel != 0) {
+        pixel = spr_pixel;
+        palette = spr_palette;
+      } else if (bg_pixel != 0 && spr_pixel != 0) {
+        pixel = spr_priority ? spr_pixel : bg_pixel;
+        palette = spr_priority ? spr_palette : bg_palette;
+
+        // Every cycle of the visible part of a scanline can hit.
+        if (sprite_0_hit_possible && (sprite & 0x40) && mask.show_sprites &&
+            mask.show_background)
+          status.sprite_0_hit = 1;
+      }
+
+      if (write_screen)
+        screen[y * screen_width + x] =
+            rendered_palettes[(palette << 2) | pixel];
+    }
+
+    // The rest of the tile's cycles. Fetch the next tile, cycles 1, 3, 5, 7.
+    // The first tile's id came from the dummy fetches on cycles 338 and 340,
+    // whatever `v` holds now.
+    auto base = start + tile * 8;
+
+    if (tile > 0)
+      bg_next_tile_id = ppu_read(0x2000 | (v.reg & 0x0fff));
+
+    auto address = 0x23c0 | (v.nametable_y << 11) | (v.nametable_x << 10) |
+                   ((v.coarse_y >> 2) << 3) | (v.coarse_x >> 2);
+    bg_next_attrib = ppu_read(address);
+    if (v.coarse_y & 0x02)
+      bg_next_attrib >>= 4;
+    if (v.coarse_x & 0x02)
+      bg_next_attrib >>= 2;
+    bg_next_attrib &= 0x03;
+
+    // Pattern fetches are visible to mappers watching A12, at the right dot.
+    dot = base + 4;
+    bg_next_tile_lo = ppu_read((control.background_pattern_table << 12) +
+                               ((uint16_t)bg_next_tile_id << 4) + v.fine_y);
+    dot = base + 6;
+    bg_next_tile_hi = ppu_read((control.background_pattern_table << 12) +
+                               ((uint16_t)bg_next_tile_id << 4) + v.fine_y + 8);
+
+    // And the 7 shifts of cycles 2 -> 8.
+    if (mask.show_background) {
+      sr_bg_pattern_lo <<= 7;
+      sr_bg_pattern_hi <<= 7;
+      sr_bg_attrib_lo <<= 7;
+      sr_bg_attrib_hi <<= 7;
+    }
+
+    increment_coarse_x();
+  }
+
+  increment_y();
+
+  // Sprites count down their x on cycles 2 -> 256, and shift once they are
+  // out of it.
+  if (mask.show_sprites) {
+    const auto updates = 255;
+
+    // Whatever is in the first slot wins the last dot if it is opaque there.
+    auto last = screen_width - 1 - secondary_oam[0].x;
+    sprite_0_hit_rendered =
+        sprites > 0 && last < 8 &&
+        ((sr_sprite_pattern[0] >> (14 - last * 2)) & 0x3) != 0;
+
+    for (auto i = 0; i < sprites; i++) {
+      auto &sprite = secondary_oam[i];
+      auto shifts = updates - sprite.x;
+
+      if (shifts <= 0) {
+        sprite.x -= updates;
+        continue;
+      }
+
+      sprite.x = 0;
+      sr_sprite_pattern[i] =
+          shifts >= 8 ? 0 : (uint16_t)(sr_sprite_pattern[i] << (shifts * 2));
+    }
+
+  }
+
+  dot = start + 256;
+  cycle = 257;
+}
+
+// Position of (scanline, cycle) within a frame, starting at the pre-render
+// scanline. (0, 0) is skipped on every frame, so it shares its position with
+// (0, 1), and everything after it shifts back by one.
+static uint32_t frame_position(int16_t scanline, int16_t cycle) noexcept {
+  uint32_t position = (scanline + 1) * 341 + cycle;
+  if (scanline > 0 || (scanline == 0 && cycle > 0))
+    position--;
+
+  return position;
+}
+
+uint32_t PPU::dots_until(int16_t target_scanline,
+                         int16_t target_cycle) const noexcept {
+  auto from = frame_position(scanline, cycle);
+  auto to = frame_position(target_scanline, target_cycle);
+
+  return (to + dots_per_frame - from) % dots_per_frame;
+}
+
+uint32_t PPU::dots_until_cycle(int16_t target_cycle) const noexcept {
+  int16_t target_scanline = cycle <= target_cycle ? scanline : scanline + 1;
+  if (target_scanline > 260)
+    target_scanline = -1;
+
+  return dots_until(target_scanline, target_cycle);
+}
+
 size_t PPU::get_color(size_t index, uint8_t pixel) const noexcept {
   // Palettes have 4 entries. palette << 2 == palette * 4.
-  return colors[ppu_read(0x3f00 + (index << 2) + pixel) & 0x3f];
+  return rendered_palettes[(index << 2) + pixel];
+}
+
+void PPU::resolve_palettes() noexcept {
+  for (uint16_t i = 0; i < rendered_palettes.size(); i++)
+    rendered_palettes[i] = colors[ppu_read(0x3f00 + i) & 0x3f];
+
+  palette_generation++;
+}
+
+uint64_t PPU::generation() const noexcept {
+  // Both only ever go up, so neither can move without the sum moving.
+  return (uint64_t)palette_generation + cart->chr_generation();
+}
+
+uint64_t PPU::screen_hash() const noexcept {
+  uint64_t hash = 0xcbf29ce484222325;
+
+  for (auto pixel : screen) {
+    hash ^= pixel;
+    hash *= 0x100000001b3;
+  }
+
+  return hash;
+}
+
+void PPU::save(PPUState &state) const noexcept {
+  state.registers = *this;
+  state.scanline = scanline;
+  state.cycle = cycle;
+
+  state.data_buffer = data_buffer;
+  state.address_latch = address_latch;
+  state.fine_x = fine_x;
+  state.palette_memory = palette_memory;
+
+  state.bg_next_tile_id = bg_next_tile_id;
+  state.bg_next_attrib = bg_next_attrib;
+  state.bg_next_tile_lo = bg_next_tile_lo;
+  state.bg_next_tile_hi = bg_next_tile_hi;
+  state.sr_bg_pattern_lo = sr_bg_pattern_lo;
+  state.sr_bg_pattern_hi = sr_bg_pattern_hi;
+  state.sr_bg_attrib_lo = sr_bg_attrib_lo;
+  state.sr_bg_attrib_hi = sr_bg_attrib_hi;
+  state.sr_sprite_pattern = sr_sprite_pattern;
+
+  state.oam = oam;
+  state.secondary_oam = secondary_oam;
+  state.sprite_count = sprite_count;
+  state.sprite_0_hit_possible = sprite_0_hit_possible;
+  state.sprite_0_hit_rendered = sprite_0_hit_rendered;
+
+  state.dot = dot;
+  state.a12_high_dot = a12_high_dot;
+
+  state.nametables = nametables;
+  state.nmi = nmi;
+  state.frame_complete = frame_complete;
+}
+
+void PPU::load(const PPUState &state) noexcept {
+  Registers::operator=(state.registers);
+  scanline = state.scanline;
+  cycle = state.cycle;
+
+  data_buffer = state.data_buffer;
+  address_latch = state.address_latch;
+  fine_x = state.fine_x;
+  palette_memory = state.palette_memory;
+
+  bg_next_tile_id = state.bg_next_tile_id;
+  bg_next_attrib = state.bg_next_attrib;
+  bg_next_tile_lo = state.bg_next_tile_lo;
+  bg_next_tile_hi = state.bg_next_tile_hi;
+  sr_bg_pattern_lo = state.sr_bg_pattern_lo;
+  sr_bg_pattern_hi = state.sr_bg_pattern_hi;
+  sr_bg_attrib_lo = state.sr_bg_attrib_lo;
+  sr_bg_attrib_hi = state.sr_bg_attrib_hi;
+  sr_sprite_pattern = state.sr_sprite_pattern;
+
+  oam = state.oam;
+  secondary_oam = state.secondary_oam;
+  sprite_count = state.sprite_count;
+  sprite_0_hit_possible = state.sprite_0_hit_possible;
+  sprite_0_hit_rendered = state.sprite_0_hit_rendered;
+
+  dot = state.dot;
+  a12_high_dot = state.a12_high_dot;
+
+  nametables = state.nametables;
+  nmi = state.nmi;
+  frame_complete = state.frame_complete;
+
+  // Both palettes and mask may have changed under the cache.
+  resolve_palettes();
 }
 
-std::array<uint32_t, 128 * 128> PPU::pattern_table(uint8_t index) noexcept {
-  auto table = rendered_pattern_tables[index & 0x1];
+const std::array<uint32_t, 128 * 128> &
+PPU::pattern_table(uint8_t index) noexcept {
+  auto &table = rendered_pattern_tables[index & 0x1];
+
+  auto current = generation();
+  if (pattern_table_generations[index & 0x1] == current)
+    return table;
+
+  pattern_table_generations[index & 0x1] = current;
 
   for (uint16_t tile_y = 0; tile_y < 16; tile_y++) {
     for (uint16_t tile_x = 0; tile_x < 16; tile_x++) {
       uint16_t tile_offset = (tile_y * 16 + tile_x) * 16;
 
-      for (uint16_t row = 0; row < 8; row++) {
-        uint16_t addr = (index * 0x1000) + tile_offset + row;
-
-        uint8_t lo = ppu_read(addr);
-        uint8_t hi = ppu_read(addr + 0x08);
+      // Straight from the cart, debug views shouldn't wiggle A12.
+      auto &tile = cart->tile((index & 0x1) * 0x1000 + tile_offset);
 
+      for (uint16_t row = 0; row < 8; row++) {
         for (uint16_t col = 0; col < 8; col++) {
-          uint8_t pixel = (lo & 0x1) + (hi & 0x1);
-
-          lo >>= 1;
-          hi >>= 1;
+          uint8_t pixel = (tile.rows[row] >> (14 - col * 2)) & 0x3;
 
-          auto pixel_idx =
-              ((tile_y * 8 + row) * 128) + (tile_x * 8 + (7 - col));
+          auto pixel_idx = ((tile_y * 8 + row) * 128) + (tile_x * 8 + col);
 
           const static auto palette = 4;
           table[pixel_idx] = get_color(palette, pixel);
@@ -474,13 +774,7 @@ std::array<uint32_t, 128 * 128> PPU::pattern_table(uint8_t index) noexcept {
   return table;
 }
 
-std::array<uint32_t, 8 * 4> PPU::get_rendered_palettes() noexcept {
-  for (uint8_t i = 0; i < 8; i++) {
-    for (uint8_t pixel = 0; pixel < 4; pixel++) {
-      rendered_palettes[i * 4 + pixel] = get_color(i, pixel);
-    }
-  }
-
+const std::array<uint32_t, 8 * 4> &PPU::get_rendered_palettes() const noexcept {
   return rendered_palettes;
 }
 
@@ -523,11 +817,18 @@ void PPU::bus_write(uint16_t addr, uint8_t val) noexcept {
     control.reg = val;
     t.nametable_x = control.nametable_x;
     t.nametable_y = control.nametable_y;
-  } break;                          // Control.
-  case 0x01: mask.reg = val; break; // Mask.
-  case 0x02: break;                 // Status.
-  case 0x03: break;                 // OAM address.
-  case 0x04: break;                 // OAM data.
+  } break; // Control.
+  case 0x01: {
+    // Grayscale and emphasis change the final colors.
+    auto color_bits = (mask.reg ^ val) & 0xe1;
+    mask.reg = val;
+
+    if (color_bits)
+      resolve_palettes();
+  } break;          // Mask.
+  case 0x02: break; // Status.
+  case 0x03: break; // OAM address.
+  case 0x04: break; // OAM data.
 
   case 0x05: {
     if (address_latch == 0) {
@@ -561,26 +862,67 @@ void PPU::bus_write(uint16_t addr, uint8_t val) noexcept {
   }
 }
 
-uint8_t PPU::ppu_read(uint16_t addr) const noexcept {
-  uint8_t data = 0;
-  addr &= 0x3fff;
+uint8_t PPU::nametable_index(uint16_t addr) const noexcept {
+  switch (cart->mirroring_mode()) {
+  case cart::MirroringMode::Vertical: return (addr & (1 << 0xa)) >> 0xa;
+  case cart::MirroringMode::Horizontal: return (addr & (1 << 0xb)) >> 0xb;
+  case cart::MirroringMode::OneScreenLo: return 0;
+  case cart::MirroringMode::OneScreenHi: return 1;
+  }
 
-  if (cart->ppu_read(addr, data))
-    return data;
+  return 0;
+}
 
-  switch (addr) {
-  case 0x0000 ... 0x1fff: return pattern[(addr & 0x1000) >> 12][addr & 0x0fff];
+void PPU::track_a12(uint16_t addr) noexcept {
+  if ((addr & 0x1000) == 0)
+    return;
 
-  case 0x2000 ... 0x3eff:
-    addr &= 0x0fff;
+  // The mapper only sees a rise if A12 stayed low for a while, which filters
+  // out the back-to-back fetches within a scanline (the longest gap being the
+  // nametable fetches across the end of a scanline).
+  if (dot - a12_high_dot > a12_filter_dots)
+    cart->a12_rise();
 
-    if (cart->mirroring_mode == cart::MirroringMode::Vertical) {
-      return nametables[(addr & (1 << 0xa)) >> 0xa][addr & 0x3ff];
-    } else if (cart->mirroring_mode == cart::MirroringMode::Horizontal) {
-      return nametables[(addr & (1 << 0xb)) >> 0xb][addr & 0x3ff];
+  a12_high_dot = dot;
+}
+
+uint16_t PPU::fetch_sprite_row(uint16_t addr, bool flip) noexcept {
+  // Leftover sprites on the pre-render scanline can produce addresses outside
+  // the pattern tables. Fetch those the slow way.
+  if (addr >= 0x2000 || (addr & 0x08)) {
+    uint8_t lo = ppu_read(addr);
+    uint8_t hi = ppu_read(addr + 8);
+    uint16_t row = 0;
+
+    for (auto col = 0; col < 8; col++) {
+      uint16_t pixel =
+          (((hi >> (7 - col)) & 0x1) << 1) | ((lo >> (7 - col)) & 0x1);
+      row |= pixel << (flip ? col * 2 : 14 - col * 2);
     }
 
-    return 0;
+    return row;
+  }
+
+  if (watch_a12)
+    track_a12(addr);
+
+  auto &tile = cart->tile(addr);
+  return flip ? tile.flipped_rows[addr & 0x07] : tile.rows[addr & 0x07];
+}
+
+uint8_t PPU::ppu_read(uint16_t addr) noexcept {
+  addr &= 0x3fff;
+
+  switch (addr) {
+  case 0x0000 ... 0x1fff:
+    if (watch_a12)
+      track_a12(addr);
+
+    return cart->ppu_read(addr);
+
+  case 0x2000 ... 0x3eff:
+    addr &= 0x0fff;
+    return nametables[nametable_index(addr)][addr & 0x3ff];
 
   case 0x3f00 ... 0x3fff: {
     addr &= 0x001f;
@@ -602,29 +944,17 @@ uint8_t PPU::ppu_read(uint16_t addr) const noexcept {
 void PPU::ppu_write(uint16_t addr, uint8_t value) noexcept {
   addr &= 0x3fff;
 
-  if (cart->ppu_write(addr, value))
-    return;
-
   switch (addr) {
   case 0x0000 ... 0x1fff:
-    // Address is between 0x0000 and 0x1fff. To get "which patterntable to
-    // address", we take the MSB. And then to get the index inside the
-    // patterntable, we mask it with 0x0fff (the patterntable size).
-    // Bless hex and bitwise.
-    pattern[(addr & 0x1000) >> 12][addr & 0x0fff] = value;
+    if (watch_a12)
+      track_a12(addr);
+
+    cart->ppu_write(addr, value);
     break;
 
   case 0x2000 ... 0x3eff:
     addr &= 0x0fff;
-
-    if (cart->mirroring_mode == cart::MirroringMode::Vertical) {
-      auto nametable_idx = (addr & (1 << 0xa)) >> 0xa;
-      nametables[nametable_idx][addr & 0x3ff] = value;
-    } else if (cart->mirroring_mode == cart::MirroringMode::Horizontal) {
-      auto nametable_idx = (addr & (1 << 0xb)) >> 0xb;
-      nametables[nametable_idx][addr & 0x3ff] = value;
-    }
-
+    nametables[nametable_index(addr)][addr & 0x3ff] = value;
     break;
 
   case 0x3f00 ... 0x3fff: {
@@ -638,6 +968,7 @@ void PPU::ppu_write(uint16_t addr, uint8_t value) noexcept {
     }
 
     palette_memory[addr] = value;
+    resolve_palettes();
   } break;
 
   default: break;
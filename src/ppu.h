@@ -74,6 +74,42 @@ struct OAMEntry {
   uint8_t x;
 };
 
+// Snapshot of the PPU, down to its internal latches and shift registers. The
+// screen isn't part of it, the next frame draws over it anyway.
+struct PPUState {
+  Registers registers;
+  int16_t scanline;
+  int16_t cycle;
+
+  uint8_t data_buffer;
+  uint8_t address_latch;
+  uint8_t fine_x;
+  std::array<uint8_t, 32> palette_memory;
+
+  uint8_t bg_next_tile_id;
+  uint8_t bg_next_attrib;
+  uint8_t bg_next_tile_lo;
+  uint8_t bg_next_tile_hi;
+  uint16_t sr_bg_pattern_lo;
+  uint16_t sr_bg_pattern_hi;
+  uint16_t sr_bg_attrib_lo;
+  uint16_t sr_bg_attrib_hi;
+  std::array<uint16_t, 8> sr_sprite_pattern;
+
+  std::array<OAMEntry, 64> oam;
+  std::array<OAMEntry, 8> secondary_oam;
+  uint8_t sprite_count;
+  bool sprite_0_hit_possible;
+  bool sprite_0_hit_rendered;
+
+  uint64_t dot;
+  uint64_t a12_high_dot;
+
+  std::array<std::array<uint8_t, 1024>, 2> nametables;
+  bool nmi;
+  bool frame_complete;
+};
+
 class PPU : public Registers {
   int16_t scanline = 0;
   int16_t cycle = 0;
@@ -83,7 +119,6 @@ class PPU : public Registers {
   uint8_t fine_x = 0; // Supposed to be 3 bits, but I am not making an unaligned
                       // bitfield here.
 
-  std::array<std::array<uint8_t, 4096>, 2> pattern{};
   std::array<uint8_t, 32> palette_memory{};
 
   // 64 NES colors stored as RGB.
@@ -103,11 +138,21 @@ class PPU : public Registers {
   std::shared_ptr<cart::Cart> cart;
 
   [[nodiscard]] size_t get_color(size_t index, uint8_t pixel) const noexcept;
+  // Which of the two nametables $2000 -> $2fff (masked to $0fff) lands on,
+  // given the cart's current mirroring.
+  [[nodiscard]] uint8_t nametable_index(uint16_t addr) const noexcept;
 
+  // Debug views of the pattern tables, and the generation they were drawn at.
   std::array<std::array<uint32_t, 128 * 128>, 2> rendered_pattern_tables{};
-  // 8 palettes, 4 colors, 3 channels. Use GL NEAREST_NEIGHBOUR to upscale. I
-  // can't spare more CPU cycles on rendering debug information.
+  std::array<uint64_t, 2> pattern_table_generations{~0ull, ~0ull};
+  // Counts palette rebuilds.
+  uint32_t palette_generation = 0;
+
+  // 8 palettes, 4 colors, resolved all the way to RGBA. Only rebuilt when the
+  // palette memory or the mask's color bits change. Doubles as the debug view
+  // (use GL NEAREST_NEIGHBOUR to upscale).
   std::array<uint32_t, 8 * 4> rendered_palettes{};
+  void resolve_palettes() noexcept;
 
   // We will use the PPU frame timing diagram as a reference.
   // https://www.nesdev.org/w/images/default/4/4f/Ppu.svg
@@ -127,8 +172,8 @@ class PPU : public Registers {
   uint16_t sr_bg_attrib_lo = 0;
   uint16_t sr_bg_attrib_hi = 0;
 
-  std::array<uint8_t, 8> sr_sprite_pattern_lo;
-  std::array<uint8_t, 8> sr_sprite_pattern_hi;
+  // Sprite patterns, 2 bits per pixel (see `cart::DecodedTile`).
+  std::array<uint16_t, 8> sr_sprite_pattern{};
 
   std::array<OAMEntry, 64> oam{};
   std::array<OAMEntry, 8> secondary_oam{};
@@ -137,9 +182,36 @@ class PPU : public Registers {
   bool sprite_0_hit_possible = false;
   bool sprite_0_hit_rendered = false;
 
+  // Dots ticked since power on.
+  uint64_t dot = 0;
+
+  // Mappers with a scanline counter (MMC3) watch A12 of the PPU address bus.
+  // Without one, pattern fetches skip the tracking altogether.
+  const bool watch_a12;
+  const static auto a12_filter_dots = 16;
+  // Last dot a pattern fetch had A12 high.
+  uint64_t a12_high_dot = 0;
+
+  void track_a12(uint16_t addr) noexcept;
+  // Fetch a sprite's pattern row, flipped horizontally if asked to.
+  uint16_t fetch_sprite_row(uint16_t addr, bool flip) noexcept;
+
+  // Loopy register updates and background shift register loads.
+  void increment_coarse_x() noexcept;
+  void increment_y() noexcept;
+  void transfer_x_addr() noexcept;
+  void transfer_y_addr() noexcept;
+  void load_sr_bg() noexcept;
+
+  // Render dots 1 -> 256 of a visible scanline in one go. Ends up in exactly
+  // the same state as ticking through them.
+  void render_line() noexcept;
+
 public:
   const static auto screen_width = 256;
   const static auto screen_height = 240;
+  // 262 scanlines of 341 dots, minus the skipped (0, 0) dot.
+  const static auto dots_per_frame = 262 * 341 - 1;
 
   std::array<std::array<uint8_t, 1024>, 2> nametables{};
   uint8_t *oam_memory = (uint8_t *)oam.data();
@@ -153,16 +225,47 @@ public:
   explicit PPU(std::shared_ptr<cart::Cart> cart) noexcept;
   ~PPU() noexcept;
 
-  void tick() noexcept;
+  // Render whole visible scanlines at once whenever `run` gets to cover them.
+  // Off means every dot goes through `tick`.
+  bool scanline_renderer = true;
+  // Whether pixels end up in `screen`. Frames nobody is going to see (run
+  // ahead, fast forward) turn it off, and only work out pixels where sprite 0
+  // could still hit. Everything else runs exactly the same.
+  bool write_screen = true;
 
-  std::array<uint32_t, 128 * 128> pattern_table(uint8_t index) noexcept;
-  std::array<uint32_t, 8 * 4> get_rendered_palettes() noexcept;
+  void tick() noexcept;
+  // Clock the PPU for the given number of dots. Nothing can touch the PPU in
+  // the meantime, so scanlines that fit go through the scanline renderer.
+  void run(uint64_t dots) noexcept;
+
+  // Number of ticks left before the PPU reaches (scanline, cycle). Zero means
+  // the very next tick is on that dot.
+  [[nodiscard]] uint32_t dots_until(int16_t target_scanline,
+                                    int16_t target_cycle) const noexcept;
+  // Number of ticks left before the PPU reaches `target_cycle` on whichever
+  // scanline gets there first.
+  [[nodiscard]] uint32_t dots_until_cycle(int16_t target_cycle) const noexcept;
+
+  // FNV-1a hash of the screen pixels, to compare frames without storing them.
+  [[nodiscard]] uint64_t screen_hash() const noexcept;
+
+  // Changes whenever the debug views might look different: the palettes, CHR
+  // memory, or the CHR banks changed.
+  [[nodiscard]] uint64_t generation() const noexcept;
+  // Debug views. The pattern tables are only redrawn when the generation has
+  // moved on since the last time.
+  const std::array<uint32_t, 128 * 128> &pattern_table(uint8_t index) noexcept;
+  [[nodiscard]] const std::array<uint32_t, 8 * 4> &
+  get_rendered_palettes() const noexcept;
+
+  void save(PPUState &state) const noexcept;
+  void load(const PPUState &state) noexcept;
 
   void bus_write(uint16_t addr, uint8_t val) noexcept;
   uint8_t bus_read(uint16_t addr) noexcept;
 
   void ppu_write(uint16_t address, uint8_t value) noexcept;
-  [[nodiscard]] uint8_t ppu_read(uint16_t address) const noexcept;
+  uint8_t ppu_read(uint16_t address) noexcept;
 };
 } // namespace nes::ppu
 
@@ -0,0 +1,204 @@
+#include <cstring>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "rewind.h"
+
+namespace nes::rewind {
+auto logger = spdlog::stderr_color_mt("nes::rewind");
+
+// Entries are a sequence of runs,
+//
+//   <zero bytes to skip, u16> <literal bytes, u16> <literals>
+//
+// Decoding XORs the literals into the snapshot, so the same format stores
+// keyframes (against all zeroes) and deltas (against the frame before).
+const static size_t max_run = 0xffff;
+
+static uint64_t load64(const uint8_t *data) noexcept {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static void put16(std::vector<uint8_t> &out, size_t value) noexcept {
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+// Encode `data`, XORed with `base` if there is one.
+static void encode(const uint8_t *data, const uint8_t *base, size_t size,
+                   std::vector<uint8_t> &out) noexcept {
+  auto byte = [&](size_t i) -> uint8_t {
+    return base == nullptr ? data[i] : data[i] ^ base[i];
+  };
+
+  out.clear();
+  size_t i = 0;
+
+  while (i < size) {
+    // Zeroes, a word at a time while we can.
+    auto start = i;
+    if (base != nullptr) {
+      while (i + 8 <= size && i - start + 8 <= max_run &&
+             load64(data + i) == load64(base + i))
+        i += 8;
+    }
+    while (i < size && i - start < max_run && byte(i) == 0)
+      i++;
+
+    put16(out, i - start);
+
+    // Literals, until the next run of zeroes worth skipping.
+    start = i;
+    while (i < size && i - start < max_run) {
+      if (byte(i) == 0 && i + 4 <= size && byte(i + 1) == 0 &&
+          byte(i + 2) == 0 && byte(i + 3) == 0)
+        break;
+      i++;
+    }
+
+    put16(out, i - start);
+    for (auto j = start; j < i; j++)
+      out.push_back(byte(j));
+  }
+}
+
+static void decode(const uint8_t *in, size_t in_size, uint8_t *data) noexcept {
+  auto end = in + in_size;
+  size_t i = 0;
+
+  while (in < end) {
+    i += in[0] | (in[1] << 8);
+    size_t literals = in[2] | (in[3] << 8);
+    in += 4;
+
+    for (size_t j = 0; j < literals; j++)
+      data[i++] ^= *in++;
+  }
+}
+
+RewindBuffer::RewindBuffer(size_t capacity, size_t keyframe_interval) noexcept
+    : keyframe_interval(keyframe_interval), ring(capacity),
+      newest(std::make_unique<bus::Savestate>()) {
+  scratch.reserve(sizeof(bus::Savestate) * 2);
+}
+
+size_t RewindBuffer::allocate(size_t size) noexcept {
+  if (entries.empty())
+    return 0;
+
+  // Entries are laid out oldest first from where we are writing, so whatever
+  // is in the way is the oldest.
+  auto end = entries.back().offset + entries.back().size;
+  auto offset = end;
+
+  // Entries never wrap around the end of the ring. If this one doesn't fit,
+  // whatever sits past us goes, and we start over at the beginning.
+  if (offset + size > ring.size()) {
+    while (!entries.empty() && entries.front().offset >= end)
+      evict();
+
+    offset = 0;
+  }
+
+  while (!entries.empty()) {
+    auto &oldest = entries.front();
+    if (oldest.offset >= offset + size || oldest.offset + oldest.size <= offset)
+      break;
+
+    evict();
+  }
+
+  return offset;
+}
+
+void RewindBuffer::evict() noexcept {
+  do {
+    used -= entries.front().size;
+    entries.pop_front();
+  } while (!entries.empty() && !entries.front().keyframe);
+
+  if (entries.empty())
+    since_keyframe = 0;
+}
+
+void RewindBuffer::apply(const Entry &entry,
+                         bus::Savestate &state) const noexcept {
+  auto data = (uint8_t *)&state;
+  if (entry.keyframe)
+    std::memset(data, 0, sizeof(state));
+
+  decode(&ring[entry.offset], entry.size, data);
+}
+
+void RewindBuffer::push(const bus::Savestate &state) noexcept {
+  auto keyframe = entries.empty() || since_keyframe + 1 >= keyframe_interval;
+
+  encode((const uint8_t *)&state, keyframe ? nullptr : (uint8_t *)newest.get(),
+         sizeof(state), scratch);
+
+  if (scratch.size() > ring.size()) {
+    logger->error("Rewind buffer is too small to hold a single frame");
+    return;
+  }
+
+  // If it evicts everything, this one becomes the first keyframe. Encode it
+  // again, in full.
+  auto offset = allocate(scratch.size());
+  if (entries.empty() && !keyframe) {
+    keyframe = true;
+    encode((const uint8_t *)&state, nullptr, sizeof(state), scratch);
+    offset = allocate(scratch.size());
+  }
+
+  std::memcpy(&ring[offset], scratch.data(), scratch.size());
+  entries.push_back(Entry{offset, scratch.size(), keyframe});
+  used += scratch.size();
+  since_keyframe = keyframe ? 0 : since_keyframe + 1;
+
+  *newest = state;
+}
+
+bool RewindBuffer::step_back(bus::Savestate &state) noexcept {
+  if (entries.size() < 2)
+    return false;
+
+  auto dropped = entries.back();
+  entries.pop_back();
+  used -= dropped.size;
+
+  if (!dropped.keyframe) {
+    // XOR is its own inverse.
+    apply(dropped, *newest);
+    since_keyframe--;
+  } else {
+    // Nothing to undo, replay the group before it from its keyframe instead.
+    auto keyframe = entries.size() - 1;
+    while (!entries[keyframe].keyframe)
+      keyframe--;
+
+    for (auto i = keyframe; i < entries.size(); i++)
+      apply(entries[i], *newest);
+
+    since_keyframe = entries.size() - 1 - keyframe;
+  }
+
+  state = *newest;
+  return true;
+}
+
+size_t RewindBuffer::frames() const noexcept { return entries.size(); }
+
+double RewindBuffer::seconds() const noexcept {
+  return (double)entries.size() / frames_per_second;
+}
+
+double RewindBuffer::bytes_per_second() const noexcept {
+  if (entries.empty())
+    return 0;
+
+  return (double)used / seconds();
+}
+} // namespace nes::rewind
@@ -0,0 +1,72 @@
+#ifndef NES_REWIND_H
+#define NES_REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "bus.h"
+
+namespace nes::rewind {
+// History of savestates, one per frame, kept in a fixed-size ring of bytes.
+//
+// Most of the machine doesn't change from one frame to the next, so most
+// frames are stored as the XOR against the frame before them, run-length
+// encoded (mostly runs of zeroes). Every so often there is a keyframe, stored
+// in full (still run-length encoded). Once the ring is full, the oldest
+// keyframe goes, along with every delta that depends on it.
+class RewindBuffer {
+  struct Entry {
+    size_t offset;
+    size_t size;
+    bool keyframe;
+  };
+
+  const size_t keyframe_interval;
+
+  std::vector<uint8_t> ring;
+  // Oldest first. The oldest entry is always a keyframe.
+  std::deque<Entry> entries;
+  size_t used = 0;
+  // Entries since the newest keyframe.
+  size_t since_keyframe = 0;
+
+  // Newest snapshot in full, deltas are taken against it. Stepping back XORs
+  // the newest delta back out of it.
+  std::unique_ptr<bus::Savestate> newest;
+  // Encoder output, before it goes into the ring.
+  std::vector<uint8_t> scratch;
+
+  // Make room for `size` bytes, and return where they go.
+  size_t allocate(size_t size) noexcept;
+  // Drop the oldest keyframe, and the deltas that depend on it.
+  void evict() noexcept;
+  // Apply an entry to the snapshot. Keyframes overwrite it, deltas are XORed
+  // into it.
+  void apply(const Entry &entry, bus::Savestate &state) const noexcept;
+
+public:
+  // 60 frames per second, near enough for NTSC.
+  const static auto frames_per_second = 60;
+
+  explicit RewindBuffer(size_t capacity,
+                        size_t keyframe_interval = 60) noexcept;
+
+  // Record a frame.
+  void push(const bus::Savestate &state) noexcept;
+  // Drop the newest frame, and get the one before it (which becomes the newest
+  // in turn). Fails if there is nothing to go back to.
+  bool step_back(bus::Savestate &state) noexcept;
+
+  // Number of frames we can go back to.
+  [[nodiscard]] size_t frames() const noexcept;
+  // How much history that is.
+  [[nodiscard]] double seconds() const noexcept;
+  // How many bytes of the ring a second of history takes up, on average.
+  [[nodiscard]] double bytes_per_second() const noexcept;
+};
+} // namespace nes::rewind
+
+#endif // NES_REWIND_H
@@ -0,0 +1,28 @@
+#include "runahead.h"
+
+namespace nes::runahead {
+RunAhead::RunAhead(bus::Bus &bus) noexcept
+    : bus(bus), state(std::make_unique<bus::Savestate>()) {}
+
+void RunAhead::run_frame() noexcept {
+  auto start = std::chrono::steady_clock::now();
+
+  // The real frame only shows if we aren't running ahead of it.
+  bus.run_frame(frames == 0);
+  bus.ppu.frame_complete = false;
+
+  if (frames > 0) {
+    bus.save(*state);
+
+    for (auto i = 1; i <= frames; i++) {
+      bus.run_frame(i == frames);
+      bus.ppu.frame_complete = false;
+    }
+
+    bus.load(*state);
+  }
+
+  elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+}
+} // namespace nes::runahead
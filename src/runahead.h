@@ -0,0 +1,36 @@
+#ifndef NES_RUNAHEAD_H
+#define NES_RUNAHEAD_H
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+
+#include "bus.h"
+
+namespace nes::runahead {
+// Hides the game's own input lag. Every frame runs for real, then `frames`
+// more frames run ahead with the same input, and the last of those is the one
+// on screen. Then the machine rolls back to where the real frame left it.
+//
+// Nothing but the shown frame writes to the screen, but every frame still
+// costs a whole emulated frame. Run ahead only pays off as long as all of them
+// fit in a host frame.
+class RunAhead {
+  bus::Bus &bus;
+  // Where the real frame left the machine.
+  std::unique_ptr<bus::Savestate> state;
+
+public:
+  // Number of frames to run ahead, 0 to turn it off.
+  int frames = 0;
+  // How long the last `run_frame` took, speculative frames included.
+  std::chrono::microseconds elapsed{};
+
+  explicit RunAhead(bus::Bus &bus) noexcept;
+
+  // Run a frame, with the current controller input.
+  void run_frame() noexcept;
+};
+} // namespace nes::runahead
+
+#endif // NES_RUNAHEAD_H
@@ -0,0 +1,52 @@
+#include "scheduler.h"
+
+namespace nes::scheduler {
+Scheduler::Scheduler() noexcept { deadlines.fill(never); }
+
+void Scheduler::schedule(Event event, uint64_t deadline) noexcept {
+  deadlines[(size_t)event] = deadline;
+}
+
+void Scheduler::cancel(Event event) noexcept {
+  deadlines[(size_t)event] = never;
+}
+
+bool Scheduler::scheduled(Event event) const noexcept {
+  return deadlines[(size_t)event] != never;
+}
+
+uint64_t Scheduler::deadline(Event event) const noexcept {
+  return deadlines[(size_t)event];
+}
+
+Event Scheduler::next() const noexcept {
+  size_t earliest = 0;
+
+  for (size_t i = 1; i < deadlines.size(); i++) {
+    // Strictly less, so the first event wins ties.
+    if (deadlines[i] < deadlines[earliest])
+      earliest = i;
+  }
+
+  return (Event)earliest;
+}
+
+uint64_t Scheduler::next_deadline_except(Event event) const noexcept {
+  uint64_t earliest = never;
+
+  for (size_t i = 0; i < deadlines.size(); i++) {
+    if (i != (size_t)event && deadlines[i] < earliest)
+      earliest = deadlines[i];
+  }
+
+  return earliest;
+}
+
+void Scheduler::save(SchedulerState &state) const noexcept {
+  state.deadlines = deadlines;
+}
+
+void Scheduler::load(const SchedulerState &state) noexcept {
+  deadlines = state.deadlines;
+}
+} // namespace nes::scheduler
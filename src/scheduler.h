@@ -0,0 +1,54 @@
+#ifndef NES_SCHEDULER_H
+#define NES_SCHEDULER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace nes::scheduler {
+// Everything that can happen on the master clock. The order matters, events
+// that land on the same master cycle run in this order (after the PPU has been
+// clocked for that cycle, just like the old per-dot loop did).
+enum class Event : uint8_t {
+  Cpu, // The CPU starts its next instruction.
+  Dma, // OAM DMA transfers (or waits for) its next byte.
+  Nmi, // The PPU enters vblank, and may raise an NMI.
+  Irq, // Poll the cart's IRQ line, right after the PPU may have clocked it.
+  Count,
+};
+
+struct SchedulerState {
+  std::array<uint64_t, (size_t)Event::Count> deadlines;
+};
+
+// A tiny timestamp-ordered event table. We have a handful of fixed event
+// sources, so a linear scan over an array beats any kind of heap here.
+//
+// Deadlines are absolute master clock cycles (PPU dots).
+class Scheduler {
+  std::array<uint64_t, (size_t)Event::Count> deadlines{};
+
+public:
+  constexpr const static uint64_t never = std::numeric_limits<uint64_t>::max();
+
+  Scheduler() noexcept;
+
+  void schedule(Event event, uint64_t deadline) noexcept;
+  void cancel(Event event) noexcept;
+
+  [[nodiscard]] bool scheduled(Event event) const noexcept;
+  [[nodiscard]] uint64_t deadline(Event event) const noexcept;
+
+  // Get the earliest scheduled event. Ties are broken using the order of
+  // `Event`.
+  [[nodiscard]] Event next() const noexcept;
+  // Get the earliest deadline of every event except the given one.
+  [[nodiscard]] uint64_t next_deadline_except(Event event) const noexcept;
+
+  void save(SchedulerState &state) const noexcept;
+  void load(const SchedulerState &state) noexcept;
+};
+} // namespace nes::scheduler
+
+#endif // NES_SCHEDULER_H
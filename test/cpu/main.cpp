@@ -1,4 +1,5 @@
 #include <fstream>
+#include <string>
 
 #include <fmt/format.h>
 
@@ -17,11 +18,18 @@ void setup_spdlog() {
   spdlog::set_level(spdlog::level::info);
 }
 
-bool test_opcode(uint8_t);
+bool test_opcode(uint8_t, nes::cpu::dynarec::Mode);
 
-int main() {
+int main(int argc, const char **argv) {
   setup_spdlog();
 
+  // Run the same tests on the recompiler, or on both at once.
+  auto mode = nes::cpu::dynarec::Mode::Off;
+  if (argc >= 2 && std::string(argv[1]) == "--dynarec")
+    mode = nes::cpu::dynarec::Mode::On;
+  else if (argc >= 2 && std::string(argv[1]) == "--differential")
+    mode = nes::cpu::dynarec::Mode::Differential;
+
   uint8_t opcode_idx = -1;
   spdlog::stopwatch sw;
   for (const auto &opcode : nes::cpu::op::opcodes) {
@@ -31,7 +39,7 @@ int main() {
       continue;
     }
 
-    if (!test_opcode(opcode_idx)) {
+    if (!test_opcode(opcode_idx, mode)) {
       spdlog::error("Tests failed for opcode {:#04x}", opcode_idx);
       return 1;
     }
@@ -42,7 +50,7 @@ int main() {
   return 0;
 }
 
-bool test_opcode(uint8_t opcode) {
+bool test_opcode(uint8_t opcode, nes::cpu::dynarec::Mode mode) {
   auto test_file = fmt::format("test/cpu/tests/{:02x}.json", opcode);
   auto prefix = fmt::format("[{:#04x}]", opcode);
 
@@ -69,7 +77,7 @@ bool test_opcode(uint8_t opcode) {
 
     spdlog::debug("{} [{:08}] Running ({})", prefix, test_idx, test.name);
 
-    if (test.run()) {
+    if (test.run(mode)) {
       spdlog::debug("{} [{:08}] Passed  ({})", prefix, test_idx, test.name);
     } else {
       spdlog::error("{} [{:08}] Failed  ({})", prefix, test_idx, test.name);
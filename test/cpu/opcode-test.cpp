@@ -1,10 +1,64 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
-#include "cpu.h"
+#include "cpu-impl.h"
+#include "dynarec-impl.h"
 #include "opcode-test.h"
 
 namespace nes::cpu::test {
+auto logger = spdlog::stderr_color_mt("nes::test::cpu::opcode");
+
+// Flat 64kB of memory, without any mirroring or memory mapped I/O.
+struct FlatMemory {
+  std::array<uint8_t, 1 << 16> memory{};
+
+  uint8_t read(uint16_t addr) noexcept {
+    auto value = memory[addr];
+    logger->trace("Reading from {:#06x} = {:#04x}", addr, value);
+    return value;
+  }
+
+  void write(uint16_t addr, uint8_t val) noexcept {
+    logger->trace("Writing to {:#06x} ({:#04x})", addr, val);
+    memory[addr] = val;
+  }
+};
+
+// The same memory, except that all of it is both code and plain RAM, so the
+// recompiler can translate (and run) the instruction under test.
+struct CodeFlatMemory : FlatMemory {
+  // For snapshots, which have to cover the CPU too.
+  CPU<CodeFlatMemory> *cpu = nullptr;
+
+  struct Snapshot {
+    std::array<uint8_t, 1 << 16> memory;
+    CPUState cpu;
+  };
+
+  [[nodiscard]] std::span<const uint8_t>
+  rom_code(uint16_t addr) const noexcept {
+    // Up to the end of the page, instructions straddling it get interpreted.
+    auto end = (addr | 0xff) + 1;
+    return {&memory[addr], (size_t)(end - addr)};
+  }
+
+  // Every test gets a fresh memory, nothing ever gets remapped.
+  [[nodiscard]] uint32_t code_generation() const noexcept { return 0; }
+
+  [[nodiscard]] uint8_t *ram(uint16_t addr) noexcept { return &memory[addr]; }
+
+  void save(Snapshot &snapshot) const noexcept {
+    snapshot.memory = memory;
+    cpu->save(snapshot.cpu);
+  }
+
+  bool load(const Snapshot &snapshot) noexcept {
+    memory = snapshot.memory;
+    cpu->load(snapshot.cpu);
+    return true;
+  }
+};
+
 void from_json(const nlohmann::json &j, OpcodeTest &t) {
   j.at("name").get_to(t.name);
   j.at("initial").get_to(t.initial);
@@ -22,24 +76,11 @@ void from_json(const nlohmann::json &j, OpcodeTestState &s) {
   j.at("ram").get_to(s.ram);
 }
 
-auto logger = spdlog::stderr_color_mt("nes::test::cpu::opcode");
-
-bool OpcodeTest::run() {
-  using namespace nes::cpu;
-
-  auto memory = std::array<uint8_t, 1 << 16>();
-
-  CPU cpu(
-      [&memory](uint16_t addr) {
-        auto value = memory[addr];
-        logger->trace("Reading from {:#06x} = {:#04x}", addr, value);
-        return value;
-      },
-      [&memory](uint16_t addr, uint8_t val) {
-        logger->trace("Writing to {:#06x} ({:#04x})", addr, val);
-        memory[addr] = val;
-      });
 
+namespace {
+template <typename MemoryT>
+void set_up(const OpcodeTestState &initial, CPU<MemoryT> &cpu,
+            MemoryT &memory) {
   // Set the registers.
   cpu.pc = initial.pc;
   cpu.sp = initial.sp;
@@ -53,17 +94,12 @@ bool OpcodeTest::run() {
 
   // Initialize the wram.
   for (const auto &ram_contents : initial.ram)
-    memory[ram_contents.first] = ram_contents.second;
-
-  cpu.dump_state();
-
-  auto num_cycles = cycles.size();
-  for (auto i = 0; i < num_cycles; i++) {
-    cpu.tick();
-  }
-
-  cpu.dump_state();
+    memory.memory[ram_contents.first] = ram_contents.second;
+}
 
+template <typename MemoryT>
+bool check(const OpcodeTestState &final, CPU<MemoryT> &cpu,
+           MemoryT &memory) {
   if (final.pc != cpu.pc) {
     logger->error("final.pc ({:#06x}) != cpu.pc ({:#06x})", final.pc, cpu.pc);
     return false;
@@ -90,25 +126,73 @@ bool OpcodeTest::run() {
   }
 
   // Ignore bit 5 (it is hardwired to 1).
-  if ((final.p & 0b00100000) != (cpu.p & 0b00100000)) {
+  if ((final.p | 0b00100000) != (cpu.p | 0b00100000)) {
     logger->error("final.p ({:#04x}) != cpu.p ({:#04x})", final.p, cpu.p);
     return false;
   }
 
   for (const auto &ram_contents : final.ram) {
     auto &addr = ram_contents.first;
-    if (memory[addr] != ram_contents.second) {
+    if (memory.memory[addr] != ram_contents.second) {
       logger->error("ram[{:#06x}] ({:#04x}) != final.ram[{:#06x}] ({:#04x})",
-                    addr, memory[addr], addr, ram_contents.second);
+                    addr, memory.memory[addr], addr, ram_contents.second);
       return false;
     }
   }
 
-  if (cpu.pending_cycles != 0) {
-    logger->error("cpu.pending_cycles = {} (!= 0)", cpu.pending_cycles);
+  return true;
+}
+} // namespace
+
+bool OpcodeTest::run(dynarec::Mode mode) {
+  using namespace nes::cpu;
+
+  if (mode == dynarec::Mode::Off) {
+    auto flat_memory = std::make_unique<FlatMemory>();
+
+    CPU cpu(*flat_memory);
+    set_up(initial, cpu, *flat_memory);
+
+    cpu.dump_state();
+
+    auto num_cycles = cycles.size();
+    for (auto i = 0; i < num_cycles; i++) {
+      cpu.tick();
+    }
+
+    cpu.dump_state();
+
+    if (cpu.pending_cycles != 0) {
+      logger->error("cpu.pending_cycles = {} (!= 0)", cpu.pending_cycles);
+      return false;
+    }
+
+    return check(final, cpu, *flat_memory);
+  }
+
+  auto code_memory = std::make_unique<CodeFlatMemory>();
+
+  CPU cpu(*code_memory);
+  code_memory->cpu = &cpu;
+  set_up(initial, cpu, *code_memory);
+
+  // Translate the instruction right away, it only ever runs once.
+  dynarec::Recompiler recompiler(cpu, *code_memory, mode);
+  recompiler.hot_threshold = 0;
+
+  // The budget runs out right after the instruction under test.
+  auto start = cpu.clock;
+  auto overshoot = recompiler.run((int)cycles.size());
+
+  if (overshoot != 0 || cpu.clock - start != cycles.size()) {
+    logger->error("Took {} cycles, overshot by {} (expected {} cycles)",
+                  cpu.clock - start, overshoot, cycles.size());
     return false;
   }
 
-  return true;
+  if (recompiler.mismatches > 0)
+    return false;
+
+  return check(final, cpu, *code_memory);
 }
 } // namespace nes::cpu::test
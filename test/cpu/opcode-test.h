@@ -8,6 +8,8 @@
 
 #include <nlohmann/json.hpp>
 
+#include "dynarec.h"
+
 namespace nes::cpu::test {
 struct OpcodeTestState {
   uint16_t pc;
@@ -27,7 +29,9 @@ struct OpcodeTest {
   OpcodeTestState final;
   std::vector<OpcodeTestCycles> cycles;
 
-  bool run();
+  // Runs on the interpreter, one tick at a time, unless the recompiler is
+  // turned on.
+  bool run(dynarec::Mode mode = dynarec::Mode::Off);
 };
 
 void from_json(const nlohmann::json &, OpcodeTest &);
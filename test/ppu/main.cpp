@@ -0,0 +1,119 @@
+#include <memory>
+#include <random>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/stopwatch.h>
+
+#include "cart.h"
+#include "ppu.h"
+
+using namespace nes;
+
+void setup_spdlog() {
+  auto logger = spdlog::stderr_color_mt("nes::ppu::test");
+  spdlog::set_default_logger(logger);
+
+  // The PPU and the cart are chatty.
+  spdlog::set_level(spdlog::level::warn);
+  logger->set_level(spdlog::level::info);
+}
+
+// A mapper 0 cart with CHR RAM, so scenes can draw their own tiles.
+std::shared_ptr<const cart::Rom> make_rom(uint32_t seed) {
+  auto rom = std::make_shared<cart::Rom>();
+  rom->prg_banks = 1;
+  rom->prg_rom.resize(1 << 14);
+  rom->mirroring = seed % 2 == 0 ? cart::MirroringMode::Horizontal
+                                 : cart::MirroringMode::Vertical;
+
+  return rom;
+}
+
+// Fill the pattern tables, nametables, palettes and OAM with made-up data,
+// and turn rendering on. Happens before the first dot, so the first frame
+// after power on renders too.
+void setup_scene(ppu::PPU &ppu, uint32_t seed) {
+  std::mt19937 rng(seed);
+
+  for (uint16_t addr = 0x0000; addr < 0x2000; addr++)
+    ppu.ppu_write(addr, rng());
+  for (uint16_t addr = 0x2000; addr < 0x3000; addr++)
+    ppu.ppu_write(addr, rng());
+  for (uint16_t addr = 0x3f00; addr < 0x3f20; addr++)
+    ppu.ppu_write(addr, rng() & 0x3f);
+  for (auto i = 0; i < 256; i++)
+    ppu.oam_memory[i] = rng();
+
+  ppu.bus_write(0x00, (rng() & 0x3b) | 0x80);
+  ppu.bus_write(0x05, rng());
+  ppu.bus_write(0x05, rng() % 240);
+  ppu.bus_write(0x01, 0x1e);
+}
+
+// Run a frame, with a $2006 write landing on dot 0 of `split_scanline`, and
+// scroll writes in vblank for the next frame.
+void run_frame(ppu::PPU &ppu, std::mt19937 &rng, int16_t split_scanline) {
+  ppu.frame_complete = false;
+
+  ppu.run(ppu.dots_until(split_scanline, 0));
+  ppu.bus_write(0x06, rng() & 0x3f);
+  ppu.bus_write(0x06, rng());
+
+  ppu.run(ppu.dots_until(241, 1));
+  ppu.bus_write(0x05, rng());
+  ppu.bus_write(0x05, rng() % 240);
+
+  while (!ppu.frame_complete)
+    ppu.tick();
+}
+
+// The scanline renderer has to draw exactly what ticking every dot does.
+bool test_scene(uint32_t seed, size_t frames) {
+  auto rom = make_rom(seed);
+  auto fast_cart = cart::create(rom);
+  auto slow_cart = cart::create(rom);
+  if (!fast_cart || !slow_cart) {
+    spdlog::error("Couldn't create a cart");
+    return false;
+  }
+
+  auto fast = std::make_unique<ppu::PPU>(*fast_cart);
+  auto slow = std::make_unique<ppu::PPU>(*slow_cart);
+  slow->scanline_renderer = false;
+
+  setup_scene(*fast, seed);
+  setup_scene(*slow, seed);
+
+  // Both get the same writes on the same dots.
+  std::mt19937 fast_rng(seed), slow_rng(seed);
+
+  for (size_t frame = 0; frame < frames; frame++) {
+    auto split_scanline = (int16_t)(frame == 0 ? 100 : 1 + seed * frame % 239);
+    run_frame(*fast, fast_rng, split_scanline);
+    run_frame(*slow, slow_rng, split_scanline);
+
+    if (fast->screen_hash() != slow->screen_hash()) {
+      spdlog::error("[{}] Frame {} differs, with a split on scanline {} "
+                    "({:#018x} != {:#018x})",
+                    seed, frame, split_scanline, fast->screen_hash(),
+                    slow->screen_hash());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main() {
+  setup_spdlog();
+
+  spdlog::stopwatch sw;
+
+  for (uint32_t seed = 1; seed <= 50; seed++)
+    if (!test_scene(seed, 4))
+      return 1;
+
+  spdlog::info("All tests passed! (total time elapsed = {}s)", sw);
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/stopwatch.h>
+
+#include "rewind.h"
+
+using namespace nes;
+
+void setup_spdlog() {
+  auto logger = spdlog::stderr_color_mt("nes::rewind::test");
+  spdlog::set_default_logger(logger);
+  spdlog::set_level(spdlog::level::info);
+}
+
+// Frames made up as we go. Most of every frame stays the same, like on the
+// real machine, but how much changes varies a lot. Big chunks get cleared or
+// filled now and then too, so keyframes come in all sizes, and a delta can be
+// bigger than the keyframe it builds on. Entries land all over the ring.
+class History {
+  std::mt19937 rng;
+  std::vector<std::unique_ptr<bus::Savestate>> frames;
+
+  static uint8_t *bytes(bus::Savestate &state) noexcept {
+    return (uint8_t *)&state;
+  }
+
+public:
+  explicit History(uint32_t seed) : rng(seed) {
+    auto first = std::make_unique<bus::Savestate>();
+    std::memset(first.get(), 0, sizeof(bus::Savestate));
+    for (size_t i = 0; i < sizeof(bus::Savestate) / 8; i++)
+      bytes(*first)[rng() % sizeof(bus::Savestate)] = rng();
+
+    frames.push_back(std::move(first));
+  }
+
+  // Make up the next frame, from the newest one.
+  const bus::Savestate &next() {
+    auto frame = std::make_unique<bus::Savestate>(*frames.back());
+    auto data = bytes(*frame);
+
+    if (rng() % 8 == 0) {
+      // A big chunk, cleared or filled.
+      auto size = rng() % (sizeof(bus::Savestate) / 2);
+      auto start = rng() % (sizeof(bus::Savestate) - size);
+      auto clear = rng() % 2 == 0;
+      for (size_t i = start; i < start + size; i++)
+        data[i] = clear ? 0 : rng();
+    } else {
+      // A handful of bytes, mostly next to each other.
+      auto changes = rng() % 64;
+      auto start = rng() % sizeof(bus::Savestate);
+      for (size_t i = 0; i < changes; i++) {
+        auto index = rng() % 4 == 0 ? rng() % sizeof(bus::Savestate)
+                                    : (start + i) % sizeof(bus::Savestate);
+        data[index] = rng();
+      }
+    }
+
+    frames.push_back(std::move(frame));
+    return *frames.back();
+  }
+
+  // Going back drops the newest frame, like the rewind buffer does.
+  void drop() noexcept { frames.pop_back(); }
+
+  [[nodiscard]] const bus::Savestate &newest() const noexcept {
+    return *frames.back();
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return frames.size(); }
+
+  uint32_t random() noexcept { return rng(); }
+};
+
+// Step back once, and check we got the frame before the newest.
+bool step_back(rewind::RewindBuffer &buffer, History &history,
+               bus::Savestate &restored) {
+  if (!buffer.step_back(restored)) {
+    spdlog::error("Couldn't step back, with {} frames left", buffer.frames());
+    return false;
+  }
+
+  history.drop();
+  if (std::memcmp(&restored, &history.newest(), sizeof(restored)) != 0) {
+    spdlog::error("Restored frame {} doesn't match what was pushed",
+                  history.size() - 1);
+    return false;
+  }
+
+  return true;
+}
+
+// Run a ring of `capacity` frames' worth of bytes through `pushes` pushes,
+// stepping back a few frames every now and then, and finally all the way.
+// `wrapped` is set if the ring filled up, and the oldest frames went.
+bool test_ring(uint32_t seed, size_t capacity, size_t keyframe_interval,
+               size_t pushes, bool &wrapped) {
+  History history(seed);
+  rewind::RewindBuffer buffer(capacity * sizeof(bus::Savestate),
+                              keyframe_interval);
+  auto restored = std::make_unique<bus::Savestate>();
+
+  buffer.push(history.newest());
+
+  for (size_t i = 0; i < pushes; i++) {
+    buffer.push(history.next());
+
+    // Rewinding for a bit, across a keyframe now and then.
+    if (history.random() % 16 == 0) {
+      auto steps = history.random() % (keyframe_interval * 2);
+      for (size_t j = 0; j < steps && buffer.frames() >= 2; j++)
+        if (!step_back(buffer, history, *restored))
+          return false;
+    }
+  }
+
+  // Entries only ever get evicted to make room at the end of the ring, or
+  // past the beginning once it started over.
+  auto frames = buffer.frames();
+  if (frames == 0 || frames > history.size()) {
+    spdlog::error("Kept {} of {} frames", frames, history.size());
+    return false;
+  }
+
+  wrapped = frames < history.size();
+
+  while (buffer.frames() >= 2)
+    if (!step_back(buffer, history, *restored))
+      return false;
+
+  if (buffer.step_back(*restored)) {
+    spdlog::error("Stepped back past the oldest frame");
+    return false;
+  }
+
+  spdlog::debug("[{}] Went back {} frames", seed, frames - 1);
+  return true;
+}
+
+int main() {
+  setup_spdlog();
+
+  spdlog::stopwatch sw;
+
+  // Rings from a couple of keyframes up, so the wrap point moves around, and
+  // groups get evicted whole.
+  uint32_t seed = 0;
+  auto rings = 0, wrapped_rings = 0;
+  for (size_t capacity : {3, 4, 8, 16})
+    for (size_t keyframe_interval : {1, 2, 8, 60})
+      for (size_t pushes : {10, 100, 1000}) {
+        auto wrapped = false;
+        if (!test_ring(++seed, capacity, keyframe_interval, pushes, wrapped)) {
+          spdlog::error("Failed with a ring of {} frames, keyframes every {}, "
+                        "{} pushes",
+                        capacity, keyframe_interval, pushes);
+          return 1;
+        }
+
+        rings++;
+        wrapped_rings += wrapped;
+      }
+
+  // The short runs don't fill the bigger rings, the rest should.
+  if (wrapped_rings < rings / 2) {
+    spdlog::error("Only {} of {} rings wrapped around", wrapped_rings, rings);
+    return 1;
+  }
+
+  spdlog::info("All tests passed! (total time elapsed = {}s)", sw);
+  return 0;
+}